@@ -0,0 +1,323 @@
+/*
+ * bench-csim.c - Micro-benchmarks for the cache simulator
+ *
+ * Parse mode scales a trace up by concatenating it with itself and
+ * compares the old fscanf loop against the streaming trace reader.
+ * Lookup mode times the tag-match and smallest-rank victim kernels of every
+ * kind the CPU supports across a range of associativities.
+ * Sim mode replays a synthetic trace through libcsim on each geometry
+ * with a specialized kernel, once generic and once specialized, and
+ * checks that both count the same.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "tracereader.h"
+#include "cache.h"
+#include "sim.h"
+
+/* Geometry and workload of the lookup benchmark */
+#define LOOKUP_LOG_SETS 10
+#define LOOKUP_QUERIES (1 << 20)
+#define LOOKUP_ROUNDS 20
+/* Records of the sim benchmark's trace, and passes over it */
+#define SIM_RECORDS (1 << 22)
+#define SIM_ROUNDS 4
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *name, unsigned long long records,
+	unsigned long long checksum, double seconds) {
+	printf("%-10s %12llu records %8.3f s %10.1f Mrec/s (checksum %llx)\n",
+		name, records, seconds, records / seconds / 1e6, checksum);
+}
+
+/*
+ * scaleTrace - Write repeat copies of trace into a fresh temporary
+ *              file and return its name in path.
+ */
+static int scaleTrace(const char *trace, int repeat, char *path) {
+	FILE *in = fopen(trace, "r");
+	if (!in) {
+		return 0;
+	}
+	fseek(in, 0, SEEK_END);
+	long len = ftell(in);
+	rewind(in);
+	char *text = (char *) malloc(len > 0 ? len : 1);
+	if (!text || fread(text, 1, len, in) != (size_t) len) {
+		free(text);
+		fclose(in);
+		return 0;
+	}
+	fclose(in);
+
+	strcpy(path, "/tmp/bench-csim.XXXXXX");
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		free(text);
+		return 0;
+	}
+	FILE *out = fdopen(fd, "w");
+	int i;
+	for (i = 0; i < repeat; i++) {
+		fwrite(text, 1, len, out);
+	}
+	fclose(out);
+	free(text);
+	return 1;
+}
+
+/*
+ * benchFscanf - The loop csim used to run. The format has no ',', so
+ *               every line is scanned twice: once for "op addr" and
+ *               once more with the ",size" tail taken as the op.
+ */
+static void benchFscanf(const char *path) {
+	FILE *fptr = fopen(path, "r");
+	char op;
+	unsigned long long addr;
+	int size;
+	unsigned long long records = 0;
+	unsigned long long checksum = 0;
+
+	double start = now();
+	while (fscanf(fptr, " %c %llx %d", &op, &addr, &size) > 0) {
+		++records;
+		checksum += addr ^ (unsigned long long) size;
+	}
+	report("fscanf", records, checksum, now() - start);
+	fclose(fptr);
+}
+
+static void benchReader(const char *path) {
+	TraceRecord batch[TRACE_BATCH];
+	unsigned long long records = 0;
+	unsigned long long checksum = 0;
+	size_t count;
+	size_t i;
+
+	double start = now();
+	TraceReader *reader = traceOpen(path);
+	while ((count = traceRead(reader, batch, TRACE_BATCH)) > 0) {
+		for (i = 0; i < count; i++) {
+			checksum += batch[i].addr ^ batch[i].size;
+		}
+		records += count;
+	}
+	traceClose(reader);
+	report("reader", records, checksum, now() - start);
+}
+
+static void benchParse(const char *trace, int repeat) {
+	char path[64];
+	if (!scaleTrace(trace, repeat, path)) {
+		fprintf(stderr, "Unable to scale up %s\n", trace);
+		exit(1);
+	}
+	benchFscanf(path);
+	benchReader(path);
+	unlink(path);
+}
+
+/*
+ * fillCache - Make every way of every set valid with a distinct tag and
+ *             a random last use time.
+ */
+static void fillCache(Cache *cache) {
+	size_t set;
+	int way;
+	for (set = 0; set < cache->sets; set++) {
+		for (way = 0; way < cache->E; way++) {
+			cacheTags(cache, set)[way] = (unsigned long long) way * 7919 + 1;
+			cacheRank(cache, set)[way] = rand();
+			cacheSetBit(cache->valid, cache, set, way);
+		}
+	}
+}
+
+static void benchKernel(Cache *cache, const char *kernel,
+	const size_t *sets, const unsigned long long *tags) {
+	if (!cacheSelectKernel(cache, kernel)) {
+		return;
+	}
+	unsigned long long checksum = 0;
+	int round;
+	size_t i;
+
+	double start = now();
+	for (round = 0; round < LOOKUP_ROUNDS; round++) {
+		for (i = 0; i < LOOKUP_QUERIES; i++) {
+			checksum += (unsigned int) cacheFindWay(cache, sets[i], tags[i]);
+		}
+	}
+	double lookup = now() - start;
+
+	start = now();
+	for (round = 0; round < LOOKUP_ROUNDS; round++) {
+		for (i = 0; i < LOOKUP_QUERIES; i++) {
+			checksum += cacheMinVictim(cache, sets[i]);
+		}
+	}
+	double victim = now() - start;
+
+	double total = (double) LOOKUP_ROUNDS * LOOKUP_QUERIES;
+	printf("E=%-3d %-7s %8.1f Mlookups/s %8.1f Mvictims/s (checksum %llx)\n",
+		cache->E, kernel, total / lookup / 1e6, total / victim / 1e6, checksum);
+}
+
+static void benchLookup(void) {
+	static const int assoc[] = { 1, 2, 4, 8, 16, 32 };
+	static const char *kernels[] = { "scalar", "sse2", "avx2" };
+	size_t *sets = (size_t *) malloc(LOOKUP_QUERIES * sizeof(size_t));
+	unsigned long long *tags = (unsigned long long *)
+		malloc(LOOKUP_QUERIES * sizeof(unsigned long long));
+	size_t a;
+	size_t k;
+	size_t i;
+
+	for (a = 0; a < sizeof(assoc) / sizeof(assoc[0]); a++) {
+		Cache *cache = cacheInit(LOOKUP_LOG_SETS, assoc[a], 6);
+		if (!cache || !sets || !tags) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+		srand(assoc[a]);
+		fillCache(cache);
+		// half the queries hit some way, half miss the whole set
+		for (i = 0; i < LOOKUP_QUERIES; i++) {
+			sets[i] = rand() & (cache->sets - 1);
+			tags[i] = (rand() & 1) ? (unsigned long long) (rand() % assoc[a]) * 7919 + 1 : 0;
+		}
+		for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+			benchKernel(cache, kernels[k], sets, tags);
+		}
+		cacheFree(cache);
+	}
+	free(sets);
+	free(tags);
+}
+
+/* Time SIM_ROUNDS replays of recs, returning the statistics in stats */
+static double timeSim(SimConfig *config, const TraceRecord *recs, SimStats *stats,
+	const char **kernel) {
+	Sim *sim = simCreate(config);
+	int round;
+
+	if (!sim) {
+		fprintf(stderr, "Unable to simulate s=%d E=%d b=%d\n", config->s,
+			config->E, config->b);
+		exit(1);
+	}
+	*kernel = simKernel(sim);
+	double start = now();
+	for (round = 0; round < SIM_ROUNDS; round++) {
+		size_t i;
+		for (i = 0; i < SIM_RECORDS; i += TRACE_BATCH) {
+			simAccess(sim, recs + i, TRACE_BATCH);
+		}
+	}
+	simStats(sim, stats);
+	double seconds = now() - start;
+	simDestroy(sim);
+	return seconds;
+}
+
+static void benchSim(void) {
+	static const int geometries[][3] = {
+		{5, 1, 6}, {5, 1, 5}, {5, 2, 6}, {5, 4, 6}, {6, 1, 6},
+		{6, 8, 6}, {7, 8, 6}, {10, 8, 6}, {10, 16, 6}
+	};
+	TraceRecord *recs = (TraceRecord *) malloc(SIM_RECORDS * sizeof(TraceRecord));
+	size_t g;
+	size_t i;
+
+	if (!recs) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	// a strided sweep interleaved with random accesses over 4MB
+	srand(1);
+	for (i = 0; i < SIM_RECORDS; i++) {
+		recs[i].addr = (i & 1) ? (unsigned long long) (rand() & 0x3ffff8)
+			: (unsigned long long) (i * 4) & 0xfffff;
+		recs[i].size = 8;
+		recs[i].op = (rand() & 3) ? 'L' : 'S';
+	}
+	for (g = 0; g < sizeof(geometries) / sizeof(geometries[0]); g++) {
+		SimConfig config = {
+			.s = geometries[g][0],
+			.E = geometries[g][1],
+			.b = geometries[g][2]
+		};
+		SimStats generic;
+		SimStats special;
+		const char *kernel;
+		config.generic = 1;
+		double slow = timeSim(&config, recs, &generic, &kernel);
+		config.generic = 0;
+		double fast = timeSim(&config, recs, &special, &kernel);
+		double total = (double) SIM_ROUNDS * SIM_RECORDS;
+		printf("s=%-2d E=%-2d b=%d generic %8.1f Mrec/s %-9s %8.1f Mrec/s%s\n",
+			config.s, config.E, config.b, total / slow / 1e6, kernel,
+			total / fast / 1e6, memcmp(&generic, &special, sizeof(SimStats)) == 0
+			? "" : "  MISMATCH");
+	}
+	free(recs);
+}
+
+static void usage(char *cmd) {
+	fprintf(stderr, "Usage: %s [-h] [-m parse|lookup|sim] [-r <repeat>] [-t <tracefile>]\n", cmd);
+	fprintf(stderr, "  -m <mode>   parse (default), lookup or sim\n");
+	fprintf(stderr, "  -t <file>   Trace to benchmark in parse mode\n");
+	fprintf(stderr, "  -r <n>      Concatenate the trace n times (default 20000)\n");
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	char *trace = NULL;
+	char *mode = "parse";
+	int repeat = 20000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "hm:t:r:")) != -1) {
+		switch (opt) {
+			case 'm':
+			mode = optarg;
+			break;
+			case 't':
+			trace = optarg;
+			break;
+			case 'r':
+			repeat = atoi(optarg);
+			break;
+			case 'h':
+			default:
+			usage(argv[0]);
+		}
+	}
+	if (strcmp(mode, "lookup") == 0) {
+		benchLookup();
+		return 0;
+	}
+	if (strcmp(mode, "sim") == 0) {
+		benchSim();
+		return 0;
+	}
+	if (strcmp(mode, "parse") != 0 || !trace || repeat <= 0) {
+		usage(argv[0]);
+	}
+
+	benchParse(trace, repeat);
+	return 0;
+}
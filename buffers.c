@@ -0,0 +1,161 @@
+/*
+ * buffers.c - Small fully associative buffers behind the cache
+ *
+ * Both buffers are flat arrays searched linearly; they are a few dozen
+ * lines at most in practice, where a scan beats any index.
+ */
+#include <stdlib.h>
+
+#include "buffers.h"
+
+typedef struct VictimLine {
+	unsigned long long block;
+	unsigned long long inserted;    /* order of insertion, 0 marks a free line */
+	int dirty;
+} VictimLine;
+
+struct VictimCache {
+	VictimLine *lines;
+	int count;
+	unsigned long long clock;
+};
+
+typedef struct BufferEntry {
+	unsigned long long block;
+	unsigned long long mask;        /* chunks of the block written */
+} BufferEntry;
+
+struct WriteBuffer {
+	BufferEntry *entries;   /* a FIFO of count entries from head */
+	int lines;
+	int head;
+	int count;
+	int b;
+	int chunkBits;          /* log2 of the bytes one mask bit stands for */
+};
+
+VictimCache *victimCreate(int lines) {
+	if (lines <= 0 || lines > BUFFER_MAX_LINES) {
+		return NULL;
+	}
+	VictimCache *victims = (VictimCache *) calloc(1, sizeof(VictimCache));
+	if (!victims) {
+		return NULL;
+	}
+	victims->lines = (VictimLine *) calloc(lines, sizeof(VictimLine));
+	if (!victims->lines) {
+		free(victims);
+		return NULL;
+	}
+	victims->count = lines;
+	return victims;
+}
+
+int victimTake(VictimCache *victims, unsigned long long block, int *dirty) {
+	int i;
+	for (i = 0; i < victims->count; i++) {
+		VictimLine *line = &victims->lines[i];
+		if (line->inserted && line->block == block) {
+			*dirty = line->dirty;
+			line->inserted = 0;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int victimPut(VictimCache *victims, unsigned long long block, int dirty,
+	unsigned long long *out, int *outDirty) {
+	VictimLine *slot = &victims->lines[0];
+	int pushed = 0;
+	int i;
+
+	// a free line if there is one, else the oldest
+	for (i = 0; i < victims->count && slot->inserted; i++) {
+		if (victims->lines[i].inserted < slot->inserted) {
+			slot = &victims->lines[i];
+		}
+	}
+	if (slot->inserted) {
+		*out = slot->block;
+		*outDirty = slot->dirty;
+		pushed = 1;
+	}
+	slot->block = block;
+	slot->dirty = dirty;
+	slot->inserted = ++victims->clock;
+	return pushed;
+}
+
+void victimFree(VictimCache *victims) {
+	if (!victims) {
+		return;
+	}
+	free(victims->lines);
+	free(victims);
+}
+
+WriteBuffer *writeBufferCreate(int lines, int b) {
+	if (lines <= 0 || lines > BUFFER_MAX_LINES) {
+		return NULL;
+	}
+	WriteBuffer *buffer = (WriteBuffer *) calloc(1, sizeof(WriteBuffer));
+	if (!buffer) {
+		return NULL;
+	}
+	buffer->entries = (BufferEntry *) calloc(lines, sizeof(BufferEntry));
+	if (!buffer->entries) {
+		free(buffer);
+		return NULL;
+	}
+	buffer->lines = lines;
+	buffer->b = b;
+	buffer->chunkBits = b > 6 ? b - 6 : 0;
+	return buffer;
+}
+
+unsigned long long writeBufferStore(WriteBuffer *buffer, unsigned long long addr,
+	int size) {
+	unsigned long long block = addr >> buffer->b;
+	unsigned long long offset = addr & ((1ULL << buffer->b) - 1);
+	unsigned long long last = offset + (size > 1 ? size - 1 : 0);
+	unsigned long long written = 0;
+	unsigned long long mask;
+	int first;
+	int count;
+	int i;
+
+	if (last >> buffer->b) {
+		last = (1ULL << buffer->b) - 1;
+	}
+	first = (int) (offset >> buffer->chunkBits);
+	count = (int) (last >> buffer->chunkBits) - first + 1;
+	mask = (count < 64 ? (1ULL << count) - 1 : ~0ULL) << first;
+
+	for (i = 0; i < buffer->count; i++) {
+		BufferEntry *entry = &buffer->entries[(buffer->head + i) % buffer->lines];
+		if (entry->block == block) {
+			entry->mask |= mask;
+			return 0;
+		}
+	}
+	if (buffer->count == buffer->lines) {
+		const BufferEntry *oldest = &buffer->entries[buffer->head];
+		written = (unsigned long long) __builtin_popcountll(oldest->mask) << buffer->chunkBits;
+		buffer->head = (buffer->head + 1) % buffer->lines;
+		buffer->count--;
+	}
+	BufferEntry *entry = &buffer->entries[(buffer->head + buffer->count) % buffer->lines];
+	entry->block = block;
+	entry->mask = mask;
+	buffer->count++;
+	return written;
+}
+
+void writeBufferFree(WriteBuffer *buffer) {
+	if (!buffer) {
+		return;
+	}
+	free(buffer->entries);
+	free(buffer);
+}
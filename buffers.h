@@ -0,0 +1,52 @@
+/*
+ * buffers.h - Small fully associative buffers behind the cache
+ *
+ * The victim cache catches the lines the cache evicts, dirty state
+ * included; a miss that finds its block there takes it back instead of
+ * reading memory. It evicts its least recently inserted line.
+ *
+ * The write-combining buffer holds stores on their way to memory, one
+ * entry per block with a mask of the bytes written, so stores to the
+ * same block merge into one write. Entries leave oldest first; the
+ * bytes an entry writes are counted in 1/64ths of a block when blocks
+ * are larger than 64 bytes.
+ */
+#ifndef BUFFERS_H
+#define BUFFERS_H
+
+/* Most lines either buffer may hold */
+#define BUFFER_MAX_LINES 1024
+
+typedef struct VictimCache VictimCache;
+typedef struct WriteBuffer WriteBuffer;
+
+/* NULL when lines is out of range or out of memory */
+VictimCache *victimCreate(int lines);
+
+/* Remove block if held, returning 1 and its dirty bit in *dirty */
+int victimTake(VictimCache *victims, unsigned long long block, int *dirty);
+
+/*
+ * victimPut - Insert an evicted block. When full, the oldest line makes
+ *             room: returns 1 with its block and dirty bit in *out and
+ *             *outDirty, else 0.
+ */
+int victimPut(VictimCache *victims, unsigned long long block, int dirty,
+	unsigned long long *out, int *outDirty);
+
+void victimFree(VictimCache *victims);
+
+/* NULL when lines is out of range or out of memory; blocks are 2^b bytes */
+WriteBuffer *writeBufferCreate(int lines, int b);
+
+/*
+ * writeBufferStore - Merge a store of size bytes at addr (clipped to its
+ *                    block). Returns the bytes written to memory by the
+ *                    entry it pushed out, if any.
+ */
+unsigned long long writeBufferStore(WriteBuffer *buffer, unsigned long long addr,
+	int size);
+
+void writeBufferFree(WriteBuffer *buffer);
+
+#endif /* BUFFERS_H */
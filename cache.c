@@ -0,0 +1,298 @@
+/*
+ * cache.c - Allocation of the set-major cache storage and the lookup
+ *     kernels that scan it
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+#include "cache.h"
+
+#define CACHE_ALIGN 64
+/*
+ * Below these associativities the scalar loops win (see
+ * bench-csim -m lookup): set-up and the reduction outweigh the ways
+ * compared per instruction.
+ */
+#define VECTOR_MIN_WAYS 8
+#define SSE2_VICTIM_MIN_WAYS 32
+#define AVX2_VICTIM_MIN_WAYS 8
+/* Tags per 64-byte host cache line */
+#define TAGS_PER_LINE (CACHE_ALIGN / sizeof(unsigned long long))
+
+static void *alignedAlloc(size_t bytes) {
+	void *ptr = NULL;
+	if (bytes == 0) {
+		bytes = CACHE_ALIGN;
+	}
+	if (posix_memalign(&ptr, CACHE_ALIGN, bytes) != 0) {
+		return NULL;
+	}
+	return ptr;
+}
+
+/*
+ * tagStride - Small sets are padded to a power of two so they never
+ *             straddle a line; larger ones to a whole number of lines.
+ */
+static size_t tagStride(int E) {
+	size_t stride = 1;
+	if ((size_t) E > TAGS_PER_LINE) {
+		return (E + TAGS_PER_LINE - 1) / TAGS_PER_LINE * TAGS_PER_LINE;
+	}
+	while (stride < (size_t) E) {
+		stride <<= 1;
+	}
+	return stride;
+}
+
+Cache *cacheInit(int s, int E, int b) {
+	Cache *cache = (Cache *) calloc(1, sizeof(Cache));
+	if (!cache) {
+		return NULL;
+	}
+	cache->s = s;
+	cache->E = E;
+	cache->b = b;
+	cache->sets = (size_t) 1 << s;
+	cache->stride = tagStride(E);
+	cache->maskWords = (E + 63) / 64;
+
+	// tags and rank stay uninitialised: they are only read for valid ways
+	size_t slots = cache->sets * cache->stride;
+	size_t maskBytes = cache->sets * cache->maskWords * sizeof(unsigned long long);
+	cache->tags = (unsigned long long *) alignedAlloc(slots * sizeof(unsigned long long));
+	cache->rank = (int *) alignedAlloc(slots * sizeof(int));
+	cache->valid = (unsigned long long *) alignedAlloc(maskBytes);
+	cache->dirty = (unsigned long long *) alignedAlloc(maskBytes);
+
+	if (!cache->tags || !cache->rank || !cache->valid || !cache->dirty) {
+		cacheFree(cache);
+		return NULL;
+	}
+	memset(cache->valid, 0, maskBytes);
+	memset(cache->dirty, 0, maskBytes);
+
+	if (E < VECTOR_MIN_WAYS ||
+		(!cacheSelectKernel(cache, "avx2") && !cacheSelectKernel(cache, "sse2"))) {
+		cacheSelectKernel(cache, "scalar");
+	}
+	return cache;
+}
+
+void cacheFree(Cache *cache) {
+	if (!cache) {
+		return;
+	}
+	free(cache->tags);
+	free(cache->rank);
+	free(cache->valid);
+	free(cache->dirty);
+	free(cache);
+}
+
+static int findWayScalar(const Cache *cache, size_t set,
+	unsigned long long tag) {
+	const unsigned long long *tags = cacheTags(cache, set);
+	int way;
+	for (way = 0; way < cache->E; way++) {
+		if (tags[way] == tag && cacheTestBit(cache->valid, cache, set, way)) {
+			return way;
+		}
+	}
+	return -1;
+}
+
+static int minVictimScalar(const Cache *cache, size_t set) {
+	const int *rank = cacheRank(cache, set);
+	int victim = 0;
+	int way;
+	for (way = 1; way < cache->E; way++) {
+		if (rank[way] < rank[victim]) {
+			victim = way;
+		}
+	}
+	return victim;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/*
+ * The vector kernels compare a whole 64-way slice of tags, collect one
+ * match bit per way and AND that with the slice's valid word. Padding
+ * slots past E hold garbage but their valid bits are always clear.
+ * Victim search takes the vector minimum of the ranks and then
+ * looks for its first occurrence, which picks the same way as the
+ * scalar loop.
+ */
+
+static int findWaySse2(const Cache *cache, size_t set,
+	unsigned long long tag) {
+	const unsigned long long *tags = cacheTags(cache, set);
+	const unsigned long long *valid = cache->valid + set * cache->maskWords;
+	__m128i key = _mm_set1_epi64x((long long) tag);
+	int base;
+
+	for (base = 0; base < cache->E; base += 64) {
+		int ways = cache->E - base < 64 ? cache->E - base : 64;
+		unsigned long long match = 0;
+		int way;
+		for (way = 0; way < ways; way += 2) {
+			__m128i line = _mm_loadu_si128((const __m128i *) (tags + base + way));
+			// no 64-bit compare in SSE2: both 32-bit halves must match
+			__m128i eq = _mm_cmpeq_epi32(line, key);
+			eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+			match |= (unsigned long long) _mm_movemask_pd(_mm_castsi128_pd(eq)) << way;
+		}
+		match &= valid[base >> 6];
+		if (match) {
+			return base + __builtin_ctzll(match);
+		}
+	}
+	return -1;
+}
+
+static inline __m128i minEpi32Sse2(__m128i a, __m128i b) {
+	__m128i greater = _mm_cmpgt_epi32(a, b);
+	return _mm_or_si128(_mm_and_si128(greater, b), _mm_andnot_si128(greater, a));
+}
+
+static int minVictimSse2(const Cache *cache, size_t set) {
+	const int *rank = cacheRank(cache, set);
+	int E = cache->E;
+	int best = INT_MAX;
+	int way = 0;
+
+	if (E >= 4) {
+		__m128i low = _mm_loadu_si128((const __m128i *) rank);
+		for (way = 4; way + 4 <= E; way += 4) {
+			low = minEpi32Sse2(low, _mm_loadu_si128((const __m128i *) (rank + way)));
+		}
+		low = minEpi32Sse2(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(1, 0, 3, 2)));
+		low = minEpi32Sse2(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(2, 3, 0, 1)));
+		best = _mm_cvtsi128_si32(low);
+	}
+	for (; way < E; way++) {
+		if (rank[way] < best) {
+			best = rank[way];
+		}
+	}
+
+	__m128i key = _mm_set1_epi32(best);
+	for (way = 0; way + 4 <= E; way += 4) {
+		__m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (rank + way)), key);
+		int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+		if (mask) {
+			return way + __builtin_ctz(mask);
+		}
+	}
+	for (; way < E; way++) {
+		if (rank[way] == best) {
+			return way;
+		}
+	}
+	return 0;
+}
+
+__attribute__((target("avx2")))
+static int findWayAvx2(const Cache *cache, size_t set,
+	unsigned long long tag) {
+	const unsigned long long *tags = cacheTags(cache, set);
+	const unsigned long long *valid = cache->valid + set * cache->maskWords;
+	__m256i key = _mm256_set1_epi64x((long long) tag);
+	int base;
+
+	for (base = 0; base < cache->E; base += 64) {
+		int ways = cache->E - base < 64 ? cache->E - base : 64;
+		unsigned long long match = 0;
+		int way;
+		for (way = 0; way < ways; way += 4) {
+			__m256i line = _mm256_loadu_si256((const __m256i *) (tags + base + way));
+			__m256i eq = _mm256_cmpeq_epi64(line, key);
+			match |= (unsigned long long) _mm256_movemask_pd(_mm256_castsi256_pd(eq)) << way;
+		}
+		match &= valid[base >> 6];
+		if (match) {
+			return base + __builtin_ctzll(match);
+		}
+	}
+	return -1;
+}
+
+__attribute__((target("avx2")))
+static int minVictimAvx2(const Cache *cache, size_t set) {
+	const int *rank = cacheRank(cache, set);
+	int E = cache->E;
+	int best = INT_MAX;
+	int way = 0;
+
+	if (E >= 8) {
+		__m256i wide = _mm256_loadu_si256((const __m256i *) rank);
+		for (way = 8; way + 8 <= E; way += 8) {
+			wide = _mm256_min_epi32(wide, _mm256_loadu_si256((const __m256i *) (rank + way)));
+		}
+		__m128i low = _mm_min_epi32(_mm256_castsi256_si128(wide),
+			_mm256_extracti128_si256(wide, 1));
+		low = _mm_min_epi32(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(1, 0, 3, 2)));
+		low = _mm_min_epi32(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(2, 3, 0, 1)));
+		best = _mm_cvtsi128_si32(low);
+	}
+	for (; way < E; way++) {
+		if (rank[way] < best) {
+			best = rank[way];
+		}
+	}
+
+	__m256i key = _mm256_set1_epi32(best);
+	for (way = 0; way + 8 <= E; way += 8) {
+		__m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) (rank + way)), key);
+		int mask = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+		if (mask) {
+			return way + __builtin_ctz(mask);
+		}
+	}
+	for (; way < E; way++) {
+		if (rank[way] == best) {
+			return way;
+		}
+	}
+	return 0;
+}
+
+#endif /* HAVE_X86_KERNELS */
+
+int cacheSelectKernel(Cache *cache, const char *name) {
+	if (strcmp(name, "scalar") == 0) {
+		cache->findWay = findWayScalar;
+		cache->minVictim = minVictimScalar;
+		cache->kernel = "scalar";
+		return 1;
+	}
+#ifdef HAVE_X86_KERNELS
+	// vector loads need the set padded to at least one full register
+	if (strcmp(name, "sse2") == 0 && cache->stride >= 2 &&
+		__builtin_cpu_supports("sse2")) {
+		cache->findWay = findWaySse2;
+		cache->minVictim = cache->E >= SSE2_VICTIM_MIN_WAYS
+			? minVictimSse2 : minVictimScalar;
+		cache->kernel = "sse2";
+		return 1;
+	}
+	if (strcmp(name, "avx2") == 0 && cache->stride >= 4 &&
+		__builtin_cpu_supports("avx2")) {
+		cache->findWay = findWayAvx2;
+		cache->minVictim = cache->E >= AVX2_VICTIM_MIN_WAYS
+			? minVictimAvx2 : minVictimScalar;
+		cache->kernel = "avx2";
+		return 1;
+	}
+#endif
+	return 0;
+}
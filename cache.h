@@ -0,0 +1,104 @@
+/*
+ * cache.h - Set-major storage for the simulated cache
+ *
+ * All sets live in one 64-byte aligned allocation per field rather
+ * than one calloc per set. Tags of a set are packed next to each
+ * other, valid and dirty state are bitmasks (bit w of a set's word(s)
+ * belongs to way w) and the replacement state is kept apart from the
+ * tags, so a lookup only touches the set's tag line(s) and one mask
+ * word.
+ *
+ * Each way also carries an int "rank" for the replacement policy (last
+ * use time for LRU, fill time for FIFO, use count for LFU); those
+ * policies evict the way with the smallest rank.
+ *
+ * Tag matching and the smallest-rank search run through kernels chosen
+ * when the cache is created: AVX2 or SSE2 compare several ways per
+ * instruction where the CPU supports them, with scalar loops as the
+ * fallback and for sets too narrow to benefit.
+ */
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+
+typedef struct Cache Cache;
+
+struct Cache {
+	int s;
+	int E;
+	int b;
+	size_t sets;
+	size_t stride;          /* tag slots per set, padded for alignment */
+	size_t maskWords;       /* 64-bit mask words per set */
+	unsigned long long *tags;   /* sets * stride */
+	unsigned long long *valid;  /* sets * maskWords */
+	unsigned long long *dirty;  /* sets * maskWords */
+	int *rank;                  /* sets * stride, replacement rank per way */
+	int (*findWay)(const Cache *cache, size_t set, unsigned long long tag);
+	int (*minVictim)(const Cache *cache, size_t set);
+	const char *kernel;         /* name of the selected kernels */
+};
+
+Cache *cacheInit(int s, int E, int b);
+void cacheFree(Cache *cache);
+
+/*
+ * cacheSelectKernel - Switch to the "scalar", "sse2" or "avx2" kernels.
+ *                     Returns 0 if the CPU or the geometry rules the
+ *                     named kernel out.
+ */
+int cacheSelectKernel(Cache *cache, const char *name);
+
+static inline unsigned long long *cacheTags(const Cache *cache, size_t set) {
+	return cache->tags + set * cache->stride;
+}
+
+static inline int *cacheRank(const Cache *cache, size_t set) {
+	return cache->rank + set * cache->stride;
+}
+
+static inline int cacheTestBit(const unsigned long long *mask,
+	const Cache *cache, size_t set, int way) {
+	return (mask[set * cache->maskWords + (way >> 6)] >> (way & 63)) & 1;
+}
+
+static inline void cacheSetBit(unsigned long long *mask,
+	const Cache *cache, size_t set, int way) {
+	mask[set * cache->maskWords + (way >> 6)] |= 1ULL << (way & 63);
+}
+
+static inline void cacheClearBit(unsigned long long *mask,
+	const Cache *cache, size_t set, int way) {
+	mask[set * cache->maskWords + (way >> 6)] &= ~(1ULL << (way & 63));
+}
+
+/* First invalid way in set, or -1 when the set is full */
+static inline int cacheFindInvalid(const Cache *cache, size_t set) {
+	const unsigned long long *valid = cache->valid + set * cache->maskWords;
+	size_t word;
+	for (word = 0; word < cache->maskWords; word++) {
+		unsigned long long empty = ~valid[word];
+		int used = cache->E - (int) word * 64;
+		if (used < 64) {
+			empty &= (1ULL << used) - 1;
+		}
+		if (empty) {
+			return (int) word * 64 + __builtin_ctzll(empty);
+		}
+	}
+	return -1;
+}
+
+/* Way holding tag in set, or -1 on a miss */
+static inline int cacheFindWay(const Cache *cache, size_t set,
+	unsigned long long tag) {
+	return cache->findWay(cache, set, tag);
+}
+
+/* Way of a full set with the smallest rank, the first one on ties */
+static inline int cacheMinVictim(const Cache *cache, size_t set) {
+	return cache->minVictim(cache, set);
+}
+
+#endif /* CACHE_H */
@@ -1,11 +1,14 @@
 /*
  * cachelab.c - Cache Lab helper functions
  */
+#define _DEFAULT_SOURCE
 #include <stdio.h>
+#include <stdint.h>
 #include <assert.h>
 #include <time.h>
 #include <stdbool.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include "cachelab.h"
 
@@ -18,43 +21,83 @@ int func_counter = 0;
  *                cache simulators must call this function in order to
  *                be properly autograded.
  */
-void printSummary(long hits, long misses, long evictions,
-                  long dirty_bytes, long dirty_evictions)
+void printSummary(unsigned long long hits, unsigned long long misses,
+                  unsigned long long evictions, unsigned long long dirty_bytes,
+                  unsigned long long dirty_evictions)
 {
-    printf("hits:%ld misses:%ld evictions:%ld dirty_bytes_in_cache:%ld dirty_bytes_evicted:%ld\n",
+    printf("hits:%llu misses:%llu evictions:%llu dirty_bytes_in_cache:%llu dirty_bytes_evicted:%llu\n",
             hits, misses, evictions, dirty_bytes, dirty_evictions);
     FILE* output_fp = fopen(".csim_results", "w");
     assert(output_fp);
-    fprintf(output_fp, "%ld %ld %ld %ld %ld\n", hits, misses, evictions,
+    fprintf(output_fp, "%llu %llu %llu %llu %llu\n", hits, misses, evictions,
             dirty_bytes, dirty_evictions);
     fclose(output_fp);
 }
 
 /*
- * initMatrix - Initialize the given matrices
+ * allocMatrices - Lay out A, B and tmp a stride apart, the stride being
+ *     the least power of two holding the larger matrix
  */
-void initMatrix(size_t M, size_t N, double A[N][M], double B[M][N])
+double *allocMatrices(size_t M, size_t N, bool hugePages,
+                      double **A, double **B, double **tmp)
 {
-    size_t i, j;
-    srand(time(NULL));
-    for (i = 0; i < N; i++){
-        for (j = 0; j < M; j++){
-	    /* Initialize with data that can't be represented as int or float */
-            A[i][j] = (double) rand()/8.0 + 1e10;
-            B[j][i] = (double) rand()/8.0 + 1e10;
-        }
+    size_t stride = MATRIX_MIN_STRIDE;
+    size_t align, bytes;
+    void *ptr;
+
+    if (N && M + GUARD_ROWS > SIZE_MAX / sizeof(double) / N)
+        return NULL;
+    while (stride < (M + GUARD_ROWS) * N * sizeof(double)) {
+        if (stride > SIZE_MAX / 4)
+            return NULL;
+        stride *= 2;
     }
+    align = stride < MATRIX_HUGE_ALIGN ? stride : MATRIX_HUGE_ALIGN;
+    bytes = 2 * stride + TMPCOUNT * sizeof(double);
+    bytes = (bytes + align - 1) & ~(align - 1);
+    if (posix_memalign(&ptr, align, bytes) != 0)
+        return NULL;
+#ifdef MADV_HUGEPAGE
+    /* Only a hint: without transparent huge pages it fails harmlessly */
+    if (hugePages)
+        madvise(ptr, bytes, MADV_HUGEPAGE);
+#endif
+    *A = (double *) ptr;
+    *B = (double *) ((char *) ptr + stride);
+    *tmp = (double *) ((char *) ptr + 2 * stride);
+    memset(*B + M * N, 0, GUARD_ROWS * N * sizeof(double));
+    return (double *) ptr;
+}
+
+/*
+ * matrixValue - A hash of seed, i and j, scaled so it can't be
+ *     represented as an int or float
+ */
+double matrixValue(unsigned long long seed, size_t i, size_t j)
+{
+    unsigned long long x = seed ^ (i * 0x9e3779b97f4a7c15ULL) ^
+        (j * 0xc2b2ae3d27d4eb4fULL);
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return (double) (x >> 33) / 8.0 + 1e10;
 }
 
 /*
- * copyMatrix - Make a copy of a matrix
+ * initMatrix - Initialize the given matrices, each in row order
  */
-void copyMatrix(size_t M, size_t N, double Adst[N][M], const double Asrc[N][M])
+void initMatrix(size_t M, size_t N, double A[N][M], double B[M][N],
+                unsigned long long seed)
 {
     size_t i, j;
     for (i = 0; i < N; i++)
-	for (j = 0; j < M; j++)
-	    Adst[i][j] = Asrc[i][j];
+        for (j = 0; j < M; j++)
+            A[i][j] = matrixValue(seed, i, j);
+    for (j = 0; j < M; j++)
+        for (i = 0; i < N; i++)
+            B[j][i] = matrixValue(~seed, i, j);
 }
 
 /*
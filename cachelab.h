@@ -3,13 +3,23 @@
  */
 
 #include <stdlib.h>
+#include <stdbool.h>
 #ifndef CACHELAB_TOOLS_H
 #define CACHELAB_TOOLS_H
 
 /* Maximum number of transpose functions that can be registered */
 #define MAX_TRANS_FUNCS 100
-/* Maximum value of M or N in transpose functions */
-#define MAXN 256
+/* Maximum value of M or N in transpose functions; matrices are allocated to fit */
+#define MAXN 65536
+/*
+ * Least spacing between A, B and tmp: the size of the 256 x 256 static
+ * arrays they used to live in, so small shapes keep that layout
+ */
+#define MATRIX_MIN_STRIDE ((size_t) 256 * 256 * sizeof(double))
+/* Most alignment asked of the allocator: a 2MB huge page */
+#define MATRIX_HUGE_ALIGN ((size_t) 2 << 20)
+/* Rows of zeros after B that out-of-bounds writes would land in */
+#define GUARD_ROWS 10
 /* Number of temp's allocated in temp array.  Designed to fill cache to capacity */
 #define TMPCOUNT 256
 
@@ -27,19 +37,33 @@ typedef struct trans_func {
  * printSummary - This function provides a standard way for your cache
  * simulator * to display its final hit and miss statistics
  */
-void printSummary(long hits,  /* number of  hits */
-                  long misses, /* number of misses */
-                  long evictions, /* number of evictions */
-                  long dirty_bytes, /* number of dirty bytes in cache at the end */
-                  long dirty_evictions); /* number of evictions of dirty lines*/
+void printSummary(unsigned long long hits,  /* number of  hits */
+                  unsigned long long misses, /* number of misses */
+                  unsigned long long evictions, /* number of evictions */
+                  unsigned long long dirty_bytes, /* number of dirty bytes in cache at the end */
+                  unsigned long long dirty_evictions); /* number of evictions of dirty lines*/
 
-/* Fill the matrix with data */
-void initMatrix(size_t M, size_t N, double A[N][M], double B[M][N]);
+/*
+ * allocMatrices - Allocate A (N x M), B (M x N plus GUARD_ROWS zeroed
+ *     rows) and tmp (TMPCOUNT) in one block, each starting a power of
+ *     two stride of at least MATRIX_MIN_STRIDE after the previous one,
+ *     so all three start in the same cache set of any cache up to that
+ *     size, the same for every program. hugePages asks the kernel to
+ *     back them with transparent huge pages. Returns the block to
+ *     free(), or NULL when out of memory.
+ */
+double *allocMatrices(size_t M, size_t N, bool hugePages,
+                      double **A, double **B, double **tmp);
 
 /*
- * copyMatrix - Make a copy of a matrix
+ * matrixValue - The value initMatrix puts in A[i][j]. It depends only
+ *     on seed, i and j, so results can be checked without a copy of A.
  */
-void copyMatrix(size_t M, size_t N, double Adst[N][M], const double Asrc[N][M]);
+double matrixValue(unsigned long long seed, size_t i, size_t j);
+
+/* Fill A with matrixValue(seed, ...) and B with different data */
+void initMatrix(size_t M, size_t N, double A[N][M], double B[M][N],
+                unsigned long long seed);
 
 
 /* The baseline trans function that produces correct results. */
@@ -0,0 +1,122 @@
+#!/usr/bin/python
+#
+# check-sampling.py - Validates csim's set sampling (-S). Every trace is
+#     simulated in full and sampled on a few cache geometries, and each
+#     sampled estimate of the misses is checked against the full count
+#     and its 95% confidence interval. Estimates csim declines to give an
+#     interval for (too few sampled sets saw accesses) are listed but not
+#     counted. Exits non-zero when clearly fewer than 95% of the
+#     intervals hold the full count.
+#
+#     ./check-sampling.py                  bundled traces plus a
+#                                          synthetic trace of a million
+#                                          accesses, big enough for the
+#                                          intervals to hold
+#     ./check-sampling.py -g 0             bundled traces alone
+#     ./check-sampling.py big.trace ...    given traces instead
+#
+import subprocess;
+import re;
+import os;
+import sys;
+import glob;
+import random;
+import tempfile;
+import math;
+import optparse;
+
+# (s, E, b) geometries simulated, and the sampling factors tried on each
+configs = ((4, 1, 4),
+           (6, 2, 4),
+           (8, 4, 5),
+           (10, 8, 6))
+factors = (2, 4, 8, 32)
+# Nominal coverage of the intervals, and how many binomial standard
+# deviations below it the observed coverage may fall before failing
+coverage = 0.95
+tolerance = 3
+
+#
+# simulate - Run csim with the given extra arguments and return its
+#     misses and, when sampling, the misses' interval half-width (None
+#     when csim gives none)
+#
+def simulate(trace, s, E, b, extra):
+    cmd = ["./csim", "-s", str(s), "-E", str(E), "-b", str(b), "-t", trace] + extra
+    out = subprocess.check_output(cmd).decode()
+    misses = int(re.search(r"misses:(\d+)", out).group(1))
+    error = re.search(r"misses \+-(\S+)", out)
+    if error:
+        return misses, float(error.group(1))
+    return misses, None if "too few" in out else 0.0
+
+#
+# synthetic - Write a trace of n accesses mixing strided sweeps over a
+#     few arrays with random accesses, and return its path
+#
+def synthetic(n):
+    fd, path = tempfile.mkstemp(suffix=".trace")
+    out = os.fdopen(fd, "w")
+    rng = random.Random(15213)
+    bases = [0x600000, 0x900000, 0x7ff000000]
+    for i in range(n):
+        if i % 4 == 3:
+            addr = rng.randrange(0, 1 << 22) & ~7
+        else:
+            base = bases[(i // 4096) % len(bases)]
+            addr = base + ((i * 8 * (1 + (i // 65536) % 3)) & 0x3ffff)
+        out.write(" %s %x,8\n" % ("S" if i % 5 == 0 else "L", addr))
+    out.close()
+    return path
+
+def main():
+    p = optparse.OptionParser(usage="%prog [-g n] [trace ...]")
+    p.add_option("-g", type="int", dest="generate", default=1000000,
+                 help="also check a synthetic trace of this many accesses")
+    opts, args = p.parse_args()
+
+    traces = args if args else sorted(glob.glob("traces/*.trace"))
+    generated = None
+    if opts.generate > 0:
+        generated = synthetic(opts.generate)
+        traces.append(generated)
+
+    checked = 0
+    covered = 0
+    skipped = 0
+    print("%-24s %-10s %4s %10s %12s %10s %8s" %
+          ("trace", "s:E:b", "1/k", "misses", "estimate", "+-95%", "error"))
+    for trace in traces:
+        for (s, E, b) in configs:
+            full, _ = simulate(trace, s, E, b, [])
+            for k in factors:
+                if k > (1 << s):
+                    continue
+                estimate, interval = simulate(trace, s, E, b, ["-S", str(k)])
+                relative = abs(estimate - full) / full if full else 0.0
+                if interval is None:
+                    skipped += 1
+                    print("%-24s %-10s %4d %10d %12d %10s %7.1f%%" %
+                          (os.path.basename(trace), "%d:%d:%d" % (s, E, b), k, full,
+                           estimate, "-", 100 * relative))
+                    continue
+                inside = abs(estimate - full) <= interval
+                checked += 1
+                covered += inside
+                print("%-24s %-10s %4d %10d %12d %10.0f %7.1f%%%s" %
+                      (os.path.basename(trace), "%d:%d:%d" % (s, E, b), k, full,
+                       estimate, interval, 100 * relative, "" if inside else "  outside"))
+    if generated:
+        os.remove(generated)
+
+    # About 95% of the intervals should hold the full count
+    print("%d of %d intervals hold the full-run misses, %d estimates without one" %
+          (covered, checked, skipped))
+    floor = checked * coverage - tolerance * math.sqrt(checked * coverage * (1 - coverage))
+    if covered < floor:
+        print("Coverage is below %.0f%%" % (100 * coverage))
+        sys.exit(1)
+
+# execute main only if called as a script
+if __name__ == "__main__":
+    main()
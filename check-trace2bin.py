@@ -0,0 +1,110 @@
+#!/usr/bin/python
+#
+# check-trace2bin.py - Validates csim's binary traces. Every trace is
+#     converted with trace2bin and simulated three ways: as text, as a
+#     mapped binary file and as a binary piped through stdin, which
+#     goes through the buffered reader instead. All three must agree.
+#     A synthetic trace, large enough to span several blocks and grow
+#     the read buffer, is always included; only its first half carries
+#     core ids, so it mixes blocks with and without them. Finally its
+#     binary, stamped with a version no reader knows, must be refused.
+#
+#     ./check-trace2bin.py                 bundled traces
+#     ./check-trace2bin.py big.trace ...   given traces instead
+#
+import subprocess;
+import os;
+import sys;
+import glob;
+import random;
+import tempfile;
+import optparse;
+
+# (s, E, b) geometry simulated, and the core count for the -n runs
+geometry = ["-s", "4", "-E", "2", "-b", "4"]
+cores = 4
+
+#
+# simulate - Run csim on trace, from stdin when piped, and return its output
+#
+def simulate(trace, extra, piped=False):
+    cmd = ["./csim"] + geometry + extra + ["-t", "-" if piped else trace]
+    if not piped:
+        return subprocess.check_output(cmd).decode()
+    # a pipe, as a redirected file would be mapped after all
+    with open(trace, "rb") as f:
+        return subprocess.check_output(cmd, input=f.read()).decode()
+
+#
+# synthetic - Write a trace of n accesses spread over cores, the first
+#     half tagged with their core id, and return its path
+#
+def synthetic(n):
+    fd, path = tempfile.mkstemp(suffix=".trace")
+    out = os.fdopen(fd, "w")
+    rng = random.Random(15213)
+    for i in range(n):
+        addr = (0x600000 + i * 8) if i % 3 else rng.randrange(0, 1 << 22)
+        core = " %d" % (i % cores) if i < n // 2 else ""
+        out.write(" %s %x,%d%s\n" % ("LSM"[i % 3], addr, 1 << (i % 4), core))
+    out.close()
+    return path
+
+#
+# refused - Stamp binary with an unknown version and check that csim
+#     fails on it, both mapped and piped
+#
+def refused(binary):
+    with open(binary, "r+b") as f:
+        f.seek(4)
+        f.write(b"\xff")
+    for piped in (False, True):
+        try:
+            simulate(binary, [], piped)
+            return False
+        except subprocess.CalledProcessError:
+            pass
+    return True
+
+def main():
+    p = optparse.OptionParser(usage="%prog [-g n] [trace ...]")
+    p.add_option("-g", type="int", dest="generate", default=300000,
+                 help="accesses in the synthetic trace")
+    opts, args = p.parse_args()
+
+    traces = args if args else sorted(glob.glob("traces/*.trace"))
+    generated = synthetic(opts.generate)
+    traces.append(generated)
+
+    failed = 0
+    for trace in traces:
+        fd, binary = tempfile.mkstemp(suffix=".bin")
+        os.close(fd)
+        subprocess.check_output(["./trace2bin", trace, binary], stderr=subprocess.STDOUT)
+        for extra in ([], ["-n", str(cores)]):
+            text = simulate(trace, extra)
+            mapped = simulate(binary, extra)
+            piped = simulate(binary, extra, True)
+            ok = text == mapped == piped
+            failed += not ok
+            print("%-24s %-6s %s" % (os.path.basename(trace), " ".join(extra) or "-",
+                                     "ok" if ok else "MISMATCH"))
+            if not ok:
+                print("  text:   " + text.splitlines()[0])
+                print("  mapped: " + mapped.splitlines()[0])
+                print("  piped:  " + piped.splitlines()[0])
+        if trace == generated:
+            ok = refused(binary)
+            failed += not ok
+            print("%-24s %-6s %s" % (os.path.basename(trace), "v255",
+                                     "refused" if ok else "ACCEPTED"))
+        os.remove(binary)
+    os.remove(generated)
+
+    if failed:
+        print("%d runs disagree" % failed)
+        sys.exit(1)
+
+# execute main only if called as a script
+if __name__ == "__main__":
+    main()
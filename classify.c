@@ -0,0 +1,179 @@
+/*
+ * classify.c - Three-C classification of cache misses
+ *
+ * Every block ever touched gets an entry in one append-only array, so
+ * an entry's index never changes; an open-addressed hash table maps
+ * blocks to those indices and doubles as the seen-block set. The
+ * shadow fully associative LRU cache is an intrusive doubly linked
+ * list threaded through the entries, most recent first. Looking a
+ * block up, moving it to the front and dropping the tail are all O(1),
+ * and growing either array is amortized over the blocks that filled it.
+ */
+#include <stdlib.h>
+
+#include "classify.h"
+
+#define INITIAL_ENTRIES 1024
+/* Link of an entry at either end of the list */
+#define NIL ((size_t) -1)
+
+typedef struct Entry {
+	unsigned long long block;
+	size_t prev;            /* toward the most recently used */
+	size_t next;            /* toward the least recently used */
+	int cached;             /* in the shadow cache */
+} Entry;
+
+struct Classifier {
+	int b;
+	size_t capacity;        /* blocks the shadow cache holds */
+	size_t cached;
+	size_t head;            /* most recently used entry */
+	size_t tail;            /* least recently used entry */
+	Entry *entries;
+	size_t count;
+	size_t entryCap;
+	size_t *buckets;        /* entry index + 1, 0 marks an empty bucket */
+	size_t bucketCap;
+};
+
+static size_t hashBlock(unsigned long long block, size_t cap) {
+	block *= 0x9e3779b97f4a7c15ULL;
+	return (size_t) (block >> 32) & (cap - 1);
+}
+
+/* Bucket holding block, or the empty bucket it would go in */
+static size_t *findBucket(const Classifier *classifier, unsigned long long block) {
+	size_t h = hashBlock(block, classifier->bucketCap);
+	while (classifier->buckets[h] &&
+		classifier->entries[classifier->buckets[h] - 1].block != block) {
+		h = (h + 1) & (classifier->bucketCap - 1);
+	}
+	return &classifier->buckets[h];
+}
+
+/* grow - Make room for one more entry, keeping the table at most half full */
+static int grow(Classifier *classifier) {
+	if (classifier->count == classifier->entryCap) {
+		size_t cap = classifier->entryCap * 2;
+		Entry *entries = (Entry *) realloc(classifier->entries, cap * sizeof(Entry));
+		if (!entries) {
+			return 0;
+		}
+		classifier->entries = entries;
+		classifier->entryCap = cap;
+	}
+	if (2 * (classifier->count + 1) > classifier->bucketCap) {
+		size_t *old = classifier->buckets;
+		size_t oldCap = classifier->bucketCap;
+		size_t i;
+		classifier->buckets = (size_t *) calloc(oldCap * 2, sizeof(size_t));
+		if (!classifier->buckets) {
+			classifier->buckets = old;
+			return 0;
+		}
+		classifier->bucketCap = oldCap * 2;
+		for (i = 0; i < oldCap; i++) {
+			if (old[i]) {
+				*findBucket(classifier, classifier->entries[old[i] - 1].block) = old[i];
+			}
+		}
+		free(old);
+	}
+	return 1;
+}
+
+static void listRemove(Classifier *classifier, size_t index) {
+	Entry *entry = &classifier->entries[index];
+	if (entry->prev != NIL) {
+		classifier->entries[entry->prev].next = entry->next;
+	} else {
+		classifier->head = entry->next;
+	}
+	if (entry->next != NIL) {
+		classifier->entries[entry->next].prev = entry->prev;
+	} else {
+		classifier->tail = entry->prev;
+	}
+}
+
+static void listPushFront(Classifier *classifier, size_t index) {
+	Entry *entry = &classifier->entries[index];
+	entry->prev = NIL;
+	entry->next = classifier->head;
+	if (classifier->head != NIL) {
+		classifier->entries[classifier->head].prev = index;
+	} else {
+		classifier->tail = index;
+	}
+	classifier->head = index;
+}
+
+/* insert - Bring an uncached entry into the shadow cache, evicting the LRU one */
+static void insert(Classifier *classifier, size_t index) {
+	if (classifier->cached == classifier->capacity) {
+		size_t victim = classifier->tail;
+		listRemove(classifier, victim);
+		classifier->entries[victim].cached = 0;
+		classifier->cached--;
+	}
+	classifier->entries[index].cached = 1;
+	classifier->cached++;
+	listPushFront(classifier, index);
+}
+
+Classifier *classifierCreate(size_t blocks, int b) {
+	Classifier *classifier = (Classifier *) calloc(1, sizeof(Classifier));
+	if (!classifier || blocks == 0) {
+		free(classifier);
+		return NULL;
+	}
+	classifier->b = b;
+	classifier->capacity = blocks;
+	classifier->head = classifier->tail = NIL;
+	classifier->entryCap = INITIAL_ENTRIES;
+	classifier->bucketCap = 2 * INITIAL_ENTRIES;
+	classifier->entries = (Entry *) malloc(classifier->entryCap * sizeof(Entry));
+	classifier->buckets = (size_t *) calloc(classifier->bucketCap, sizeof(size_t));
+	if (!classifier->entries || !classifier->buckets) {
+		classifierFree(classifier);
+		return NULL;
+	}
+	return classifier;
+}
+
+MissClass classifierAccess(Classifier *classifier, unsigned long long addr) {
+	unsigned long long block = addr >> classifier->b;
+	size_t *bucket = findBucket(classifier, block);
+
+	if (*bucket) {
+		size_t index = *bucket - 1;
+		if (classifier->entries[index].cached) {
+			listRemove(classifier, index);
+			listPushFront(classifier, index);
+			return MISS_CONFLICT;
+		}
+		insert(classifier, index);
+		return MISS_CAPACITY;
+	}
+
+	if (!grow(classifier)) {
+		return MISS_CLASSES;
+	}
+	size_t index = classifier->count++;
+	classifier->entries[index].block = block;
+	classifier->entries[index].cached = 0;
+	// the table may have been rebuilt, so look the bucket up again
+	*findBucket(classifier, block) = index + 1;
+	insert(classifier, index);
+	return MISS_COMPULSORY;
+}
+
+void classifierFree(Classifier *classifier) {
+	if (!classifier) {
+		return;
+	}
+	free(classifier->entries);
+	free(classifier->buckets);
+	free(classifier);
+}
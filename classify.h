@@ -0,0 +1,36 @@
+/*
+ * classify.h - Three-C classification of cache misses
+ *
+ * A miss is compulsory when its block was never accessed before,
+ * conflict when a fully associative LRU cache of the same capacity
+ * would still hold the block, and capacity otherwise. The classifier
+ * tracks every block seen and the contents of that shadow cache, and
+ * must see every access (hits included) to keep them current.
+ */
+#ifndef CLASSIFY_H
+#define CLASSIFY_H
+
+#include <stddef.h>
+
+typedef enum MissClass {
+	MISS_COMPULSORY,
+	MISS_CAPACITY,
+	MISS_CONFLICT,
+	MISS_CLASSES            /* number of classes, also "unclassified" */
+} MissClass;
+
+typedef struct Classifier Classifier;
+
+/* Shadow a cache of blocks lines of 2^b bytes. Returns NULL when out of memory */
+Classifier *classifierCreate(size_t blocks, int b);
+
+/*
+ * classifierAccess - Touch addr's block and return the class a miss on
+ *                    this access belongs to, or MISS_CLASSES if the
+ *                    tables could not grow to take a new block.
+ */
+MissClass classifierAccess(Classifier *classifier, unsigned long long addr);
+
+void classifierFree(Classifier *classifier);
+
+#endif /* CLASSIFY_H */
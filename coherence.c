@@ -0,0 +1,515 @@
+/*
+ * coherence.c - Private per-core caches kept coherent over a shared LLC
+ *
+ * Every core's cache is an ordinary set-major Cache with its own
+ * replacement policy and a parallel array of line states. The
+ * directory is an open-addressed hash of per-block entries that grows
+ * like the classifier's; entries stay once created, so the coherence
+ * history and false-sharing counts of a block outlive its copies.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "coherence.h"
+#include "cache.h"
+#include "policy.h"
+
+#define INITIAL_ENTRIES 1024
+
+typedef enum LineState {
+	LINE_INVALID,
+	LINE_SHARED,
+	LINE_EXCLUSIVE,
+	LINE_OWNED,
+	LINE_MODIFIED
+} LineState;
+
+typedef struct Core {
+	Cache *cache;
+	Policy *policy;
+	unsigned char *state;           /* LineState per way, sets * stride */
+	unsigned long long *touched;    /* per way: chunks accessed since the fill */
+	CoreStats stats;
+} Core;
+
+typedef struct DirEntry {
+	unsigned long long block;       /* block number + 1, 0 marks an empty bucket */
+	unsigned long long sharers;     /* cores holding a copy */
+	unsigned long long invalidated; /* cores that lost their copy to a write */
+	unsigned long long falseSharing;
+	unsigned long long trueSharing;
+	int owner;                      /* core holding it M, E or O, or -1 */
+} DirEntry;
+
+struct Coherence {
+	Core cores[COHERENCE_MAX_CORES];
+	int count;
+	CoherenceProtocol protocol;
+	Cache *llc;
+	Policy *llcPolicy;
+	int b;
+	int chunkBits;          /* log2 of the bytes one touched bit stands for */
+	int now;                /* policy clock, see policy.h */
+	DirEntry *entries;
+	size_t entryCount;
+	size_t entryCap;
+	CoherenceStats stats;
+};
+
+static size_t setOf(const Cache *cache, unsigned long long addr) {
+	return (size_t) (addr >> cache->b) & (cache->sets - 1);
+}
+
+static unsigned long long tagOf(const Cache *cache, unsigned long long addr) {
+	return addr >> (cache->b + cache->s);
+}
+
+static unsigned long long blockAddr(const Cache *cache, size_t set, int way) {
+	unsigned long long tag = cacheTags(cache, set)[way];
+	return ((tag << cache->s) | set) << cache->b;
+}
+
+static size_t slotOf(const Cache *cache, size_t set, int way) {
+	return set * cache->stride + way;
+}
+
+/* Chunks of addr's block that size bytes from addr cover */
+static unsigned long long chunksOf(const Coherence *coherence, unsigned long long addr,
+	int size) {
+	unsigned long long offset = addr & ((1ULL << coherence->b) - 1);
+	unsigned long long last = offset + (size > 1 ? size - 1 : 0);
+	if (last >> coherence->b) {
+		last = (1ULL << coherence->b) - 1;
+	}
+	int first = (int) (offset >> coherence->chunkBits);
+	int count = (int) (last >> coherence->chunkBits) - first + 1;
+	return (count < 64 ? (1ULL << count) - 1 : ~0ULL) << first;
+}
+
+static size_t hashBlock(unsigned long long block, size_t cap) {
+	block *= 0x9e3779b97f4a7c15ULL;
+	return (size_t) (block >> 32) & (cap - 1);
+}
+
+/* Bucket holding block, or the empty bucket it would go in */
+static DirEntry *findEntry(const Coherence *coherence, unsigned long long block) {
+	size_t h = hashBlock(block, coherence->entryCap);
+	while (coherence->entries[h].block && coherence->entries[h].block != block + 1) {
+		h = (h + 1) & (coherence->entryCap - 1);
+	}
+	return &coherence->entries[h];
+}
+
+/* grow - Double the directory once it is half full */
+static int grow(Coherence *coherence) {
+	DirEntry *old = coherence->entries;
+	size_t oldCap = coherence->entryCap;
+	size_t i;
+
+	if (2 * (coherence->entryCount + 1) <= coherence->entryCap) {
+		return 1;
+	}
+	coherence->entries = (DirEntry *) calloc(oldCap * 2, sizeof(DirEntry));
+	if (!coherence->entries) {
+		coherence->entries = old;
+		return 0;
+	}
+	coherence->entryCap = oldCap * 2;
+	for (i = 0; i < oldCap; i++) {
+		if (old[i].block) {
+			*findEntry(coherence, old[i].block - 1) = old[i];
+		}
+	}
+	free(old);
+	return 1;
+}
+
+/*
+ * directoryEntry - block's entry, created on first use. NULL when the
+ *                  directory is full and cannot grow. Creating one may
+ *                  move every entry, so earlier pointers go stale.
+ */
+static DirEntry *directoryEntry(Coherence *coherence, unsigned long long block) {
+	DirEntry *entry = findEntry(coherence, block);
+	if (entry->block) {
+		return entry;
+	}
+	if (!grow(coherence) && coherence->entryCount + 1 == coherence->entryCap) {
+		return NULL;
+	}
+	entry = findEntry(coherence, block);
+	entry->block = block + 1;
+	entry->owner = -1;
+	coherence->entryCount++;
+	return entry;
+}
+
+/* llcRead - Fetch the block at addr for a core from the LLC, or memory */
+static void llcRead(Coherence *coherence, unsigned long long addr) {
+	Cache *llc = coherence->llc;
+
+	if (!llc) {
+		coherence->stats.memReads++;
+		return;
+	}
+	size_t set = setOf(llc, addr);
+	int way = cacheFindWay(llc, set, tagOf(llc, addr));
+	if (way >= 0) {
+		coherence->stats.llcHits++;
+		coherence->llcPolicy->onHit(coherence->llcPolicy, llc, set, way, coherence->now);
+		return;
+	}
+	coherence->stats.llcMisses++;
+	coherence->stats.memReads++;
+	way = cacheFindInvalid(llc, set);
+	if (way >= 0) {
+		cacheSetBit(llc->valid, llc, set, way);
+	} else {
+		way = coherence->llcPolicy->victim(coherence->llcPolicy, llc, set);
+		coherence->stats.memWrites += cacheTestBit(llc->dirty, llc, set, way);
+	}
+	cacheTags(llc, set)[way] = tagOf(llc, addr);
+	cacheClearBit(llc->dirty, llc, set, way);
+	coherence->llcPolicy->onFill(coherence->llcPolicy, llc, set, way, coherence->now);
+}
+
+/* writeBack - A dirty line leaves a core: update the LLC copy, or memory */
+static void writeBack(Coherence *coherence, unsigned long long addr) {
+	Cache *llc = coherence->llc;
+	if (llc) {
+		size_t set = setOf(llc, addr);
+		int way = cacheFindWay(llc, set, tagOf(llc, addr));
+		if (way >= 0) {
+			cacheSetBit(llc->dirty, llc, set, way);
+			return;
+		}
+	}
+	coherence->stats.memWrites++;
+}
+
+/* share - Count a line other cores touched as falsely or truly shared */
+static void share(Coherence *coherence, DirEntry *entry, unsigned long long touched,
+	unsigned long long chunks) {
+	if (touched & chunks) {
+		entry->trueSharing++;
+		coherence->stats.trueSharing++;
+	} else {
+		entry->falseSharing++;
+		coherence->stats.falseSharing++;
+	}
+}
+
+/*
+ * invalidateOthers - Take the block at addr away from every core but
+ *                    writer, which is about to write chunks of it.
+ */
+static void invalidateOthers(Coherence *coherence, DirEntry *entry, int writer,
+	unsigned long long addr, unsigned long long chunks) {
+	unsigned long long others = entry->sharers & ~(1ULL << writer);
+
+	while (others) {
+		int index = __builtin_ctzll(others);
+		Core *core = &coherence->cores[index];
+		size_t set = setOf(core->cache, addr);
+		int way = cacheFindWay(core->cache, set, tagOf(core->cache, addr));
+		size_t slot = slotOf(core->cache, set, way);
+
+		others &= others - 1;
+		share(coherence, entry, core->touched[slot], chunks);
+		cacheClearBit(core->cache->valid, core->cache, set, way);
+		cacheClearBit(core->cache->dirty, core->cache, set, way);
+		core->state[slot] = LINE_INVALID;
+		core->stats.invalidated++;
+		coherence->stats.invalidations++;
+		entry->invalidated |= 1ULL << index;
+	}
+	entry->sharers &= 1ULL << writer;
+	entry->owner = -1;
+}
+
+/*
+ * downgrade - The owner of the block at addr supplies it to a core
+ *             loading chunks of it, keeping a readable copy.
+ */
+static void downgrade(Coherence *coherence, DirEntry *entry, unsigned long long addr,
+	unsigned long long chunks) {
+	Core *owner = &coherence->cores[entry->owner];
+	size_t set = setOf(owner->cache, addr);
+	int way = cacheFindWay(owner->cache, set, tagOf(owner->cache, addr));
+	size_t slot = slotOf(owner->cache, set, way);
+
+	if (owner->state[slot] == LINE_MODIFIED || owner->state[slot] == LINE_OWNED) {
+		share(coherence, entry, owner->touched[slot], chunks);
+	}
+	if (owner->state[slot] == LINE_OWNED) {
+		return;
+	}
+	if (owner->state[slot] == LINE_MODIFIED && coherence->protocol == COHERENCE_MOESI) {
+		owner->state[slot] = LINE_OWNED;
+		return;
+	}
+	if (owner->state[slot] == LINE_MODIFIED) {
+		writeBack(coherence, addr);
+		owner->stats.writebacks++;
+		cacheClearBit(owner->cache->dirty, owner->cache, set, way);
+	}
+	owner->state[slot] = LINE_SHARED;
+	entry->owner = -1;
+}
+
+/* install - Fill the block at addr into core's cache in state, evicting if full */
+static void install(Coherence *coherence, int index, unsigned long long addr,
+	LineState state, unsigned long long chunks) {
+	Core *core = &coherence->cores[index];
+	Cache *cache = core->cache;
+	size_t set = setOf(cache, addr);
+	int way = cacheFindInvalid(cache, set);
+
+	if (way >= 0) {
+		cacheSetBit(cache->valid, cache, set, way);
+	} else {
+		way = core->policy->victim(core->policy, cache, set);
+		unsigned long long victim = blockAddr(cache, set, way);
+		LineState victimState = (LineState) core->state[slotOf(cache, set, way)];
+		// the victim is cached, so its entry exists and lookup cannot grow the table
+		DirEntry *entry = findEntry(coherence, victim >> coherence->b);
+		entry->sharers &= ~(1ULL << index);
+		if (entry->owner == index) {
+			entry->owner = -1;
+		}
+		if (victimState == LINE_MODIFIED || victimState == LINE_OWNED) {
+			writeBack(coherence, victim);
+			core->stats.writebacks++;
+		}
+		core->stats.evictions++;
+	}
+
+	size_t slot = slotOf(cache, set, way);
+	cacheTags(cache, set)[way] = tagOf(cache, addr);
+	if (state == LINE_MODIFIED) {
+		cacheSetBit(cache->dirty, cache, set, way);
+	} else {
+		cacheClearBit(cache->dirty, cache, set, way);
+	}
+	core->state[slot] = (unsigned char) state;
+	core->touched[slot] = chunks;
+	core->policy->onFill(core->policy, cache, set, way, coherence->now);
+}
+
+int coherenceProtocolParse(const char *name, CoherenceProtocol *protocol) {
+	if (strcmp(name, "mesi") == 0) {
+		*protocol = COHERENCE_MESI;
+	} else if (strcmp(name, "moesi") == 0) {
+		*protocol = COHERENCE_MOESI;
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+Coherence *coherenceCreate(int cores, const LevelConfig *core, const LevelConfig *llc,
+	CoherenceProtocol protocol, const char *policyName) {
+	int i;
+
+	if (cores < 1 || cores > COHERENCE_MAX_CORES || (llc && llc->b != core->b)) {
+		return NULL;
+	}
+	Coherence *coherence = (Coherence *) calloc(1, sizeof(Coherence));
+	if (!coherence) {
+		return NULL;
+	}
+	coherence->protocol = protocol;
+	coherence->b = core->b;
+	coherence->chunkBits = core->b > 6 ? core->b - 6 : 0;
+	coherence->entryCap = 2 * INITIAL_ENTRIES;
+	coherence->entries = (DirEntry *) calloc(coherence->entryCap, sizeof(DirEntry));
+	if (!coherence->entries) {
+		coherenceFree(coherence);
+		return NULL;
+	}
+	if (llc) {
+		coherence->llc = cacheInit(llc->s, llc->E, llc->b);
+		coherence->llcPolicy = coherence->llc ?
+			policyCreate(policyName, coherence->llc) : NULL;
+		if (!coherence->llcPolicy) {
+			coherenceFree(coherence);
+			return NULL;
+		}
+	}
+	for (i = 0; i < cores; i++) {
+		Core *c = &coherence->cores[coherence->count++];
+		c->cache = cacheInit(core->s, core->E, core->b);
+		c->policy = c->cache ? policyCreate(policyName, c->cache) : NULL;
+		if (!c->policy) {
+			coherenceFree(coherence);
+			return NULL;
+		}
+		c->state = (unsigned char *) calloc(c->cache->sets * c->cache->stride, 1);
+		c->touched = (unsigned long long *) calloc(c->cache->sets * c->cache->stride,
+			sizeof(unsigned long long));
+		if (!c->state || !c->touched) {
+			coherenceFree(coherence);
+			return NULL;
+		}
+	}
+	return coherence;
+}
+
+/* tick - Advance the policy clock, rebasing every cache before it runs out */
+static void tick(Coherence *coherence) {
+	int i;
+
+	if (coherence->now >= POLICY_CLOCK_LIMIT) {
+		coherence->now = 0;
+		for (i = 0; i < coherence->count; i++) {
+			int top = policyRebase(coherence->cores[i].policy, coherence->cores[i].cache);
+			if (top > coherence->now) {
+				coherence->now = top;
+			}
+		}
+		if (coherence->llc) {
+			int top = policyRebase(coherence->llcPolicy, coherence->llc);
+			if (top > coherence->now) {
+				coherence->now = top;
+			}
+		}
+	}
+	coherence->now++;
+}
+
+int coherenceAccess(Coherence *coherence, int index, unsigned long long addr,
+	int isWrite, int size) {
+	Core *core = &coherence->cores[index];
+	Cache *cache = core->cache;
+	size_t set = setOf(cache, addr);
+	int way = cacheFindWay(cache, set, tagOf(cache, addr));
+	unsigned long long chunks = chunksOf(coherence, addr, size);
+
+	tick(coherence);
+	DirEntry *entry = directoryEntry(coherence, addr >> coherence->b);
+	if (!entry) {
+		return 0;
+	}
+
+	if (way >= 0) {
+		size_t slot = slotOf(cache, set, way);
+		core->stats.hits++;
+		core->touched[slot] |= chunks;
+		core->policy->onHit(core->policy, cache, set, way, coherence->now);
+		if (!isWrite || core->state[slot] == LINE_MODIFIED) {
+			return 1;
+		}
+		if (core->state[slot] != LINE_EXCLUSIVE) {
+			coherence->stats.upgrades++;
+			invalidateOthers(coherence, entry, index, addr, chunks);
+			entry->owner = index;
+		}
+		core->state[slot] = LINE_MODIFIED;
+		cacheSetBit(cache->dirty, cache, set, way);
+		return 1;
+	}
+
+	core->stats.misses++;
+	if (entry->invalidated & (1ULL << index)) {
+		core->stats.coherenceMisses++;
+		entry->invalidated &= ~(1ULL << index);
+	}
+
+	// a core holding the line M, E or O supplies it; the requester never does
+	int supplied = entry->owner >= 0;
+	LineState state;
+	if (supplied) {
+		coherence->stats.transfers++;
+	} else {
+		llcRead(coherence, addr);
+	}
+	if (isWrite) {
+		invalidateOthers(coherence, entry, index, addr, chunks);
+		state = LINE_MODIFIED;
+	} else {
+		if (supplied) {
+			downgrade(coherence, entry, addr, chunks);
+		}
+		state = entry->sharers ? LINE_SHARED : LINE_EXCLUSIVE;
+	}
+
+	install(coherence, index, addr, state, chunks);
+	entry->sharers |= 1ULL << index;
+	if (state != LINE_SHARED) {
+		entry->owner = index;
+	}
+	return 0;
+}
+
+const CoreStats *coherenceCoreStats(const Coherence *coherence, int core) {
+	return &coherence->cores[core].stats;
+}
+
+const CoherenceStats *coherenceStats(const Coherence *coherence) {
+	return &coherence->stats;
+}
+
+/* Orders directory entries by false sharing, most first */
+static int compareHotspots(const void *a, const void *b) {
+	const DirEntry *x = *(const DirEntry * const *) a;
+	const DirEntry *y = *(const DirEntry * const *) b;
+	if (x->falseSharing != y->falseSharing) {
+		return x->falseSharing < y->falseSharing ? 1 : -1;
+	}
+	return x->block < y->block ? -1 : x->block > y->block;
+}
+
+void coherenceReport(Coherence *coherence, FILE *out) {
+	const CoherenceStats *stats = &coherence->stats;
+	size_t hot = 0;
+	size_t i;
+	int c;
+
+	for (c = 0; c < coherence->count; c++) {
+		const CoreStats *core = &coherence->cores[c].stats;
+		fprintf(out, "core %d hits:%llu misses:%llu coherence_misses:%llu evictions:%llu "
+			"writebacks:%llu invalidated:%llu\n", c, core->hits, core->misses,
+			core->coherenceMisses, core->evictions, core->writebacks, core->invalidated);
+	}
+	fprintf(out, "invalidations:%llu upgrades:%llu transfers:%llu false_sharing:%llu "
+		"true_sharing:%llu\n", stats->invalidations, stats->upgrades, stats->transfers,
+		stats->falseSharing, stats->trueSharing);
+	if (coherence->llc) {
+		fprintf(out, "LLC hits:%llu misses:%llu\n", stats->llcHits, stats->llcMisses);
+	}
+	fprintf(out, "mem reads:%llu writes:%llu\n", stats->memReads, stats->memWrites);
+
+	DirEntry **hotspots = (DirEntry **) malloc(coherence->entryCount * sizeof(DirEntry *));
+	if (!hotspots) {
+		return;
+	}
+	for (i = 0; i < coherence->entryCap; i++) {
+		if (coherence->entries[i].block && coherence->entries[i].falseSharing) {
+			hotspots[hot++] = &coherence->entries[i];
+		}
+	}
+	qsort(hotspots, hot, sizeof(DirEntry *), compareHotspots);
+	for (i = 0; i < hot && i < COHERENCE_HOTSPOTS; i++) {
+		fprintf(out, "hotspot 0x%llx false_sharing:%llu true_sharing:%llu\n",
+			(hotspots[i]->block - 1) << coherence->b, hotspots[i]->falseSharing,
+			hotspots[i]->trueSharing);
+	}
+	free(hotspots);
+}
+
+void coherenceFree(Coherence *coherence) {
+	if (!coherence) {
+		return;
+	}
+	int i;
+	for (i = 0; i < coherence->count; i++) {
+		policyFree(coherence->cores[i].policy);
+		cacheFree(coherence->cores[i].cache);
+		free(coherence->cores[i].state);
+		free(coherence->cores[i].touched);
+	}
+	policyFree(coherence->llcPolicy);
+	cacheFree(coherence->llc);
+	free(coherence->entries);
+	free(coherence);
+}
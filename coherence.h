@@ -0,0 +1,101 @@
+/*
+ * coherence.h - Private per-core caches kept coherent over a shared LLC
+ *
+ * Each core (the core id of a trace record, modulo the core count) has
+ * its own cache. Lines are in one of the MESI states, plus Owned under
+ * MOESI:
+ *
+ *   mesi   a load miss to a Modified line elsewhere has its owner write
+ *          it back and both end up Shared
+ *   moesi  the owner keeps the dirty line as Owned and goes on
+ *          supplying it; it is written back only when evicted
+ *
+ * A store to a Shared or Owned line is an upgrade that invalidates
+ * every other copy; a store miss invalidates them too. Whenever a core
+ * holding the line Modified, Exclusive or Owned supplies it, that is a
+ * cache-to-cache transfer, otherwise the block comes from the LLC or
+ * memory. The LLC is non-inclusive and write-back, as in hierarchy.h.
+ *
+ * There is no snooping: a directory records, per block, the cores
+ * holding it and its owner, so an access only visits the caches that
+ * share the block. The directory also remembers, per block, which cores
+ * lost it to another core's write (their next miss on it is a
+ * coherence miss) and counts false sharing: an invalidation, or a
+ * downgrade of a dirty line, where the bytes the other core touched
+ * since it got the line do not overlap the bytes accessed now. Bytes
+ * are tracked in 1/64ths of a block when blocks are larger than 64
+ * bytes.
+ */
+#ifndef COHERENCE_H
+#define COHERENCE_H
+
+#include <stdio.h>
+
+#include "hierarchy.h"
+
+/* Most cores, one bit each in the directory's sharer masks */
+#define COHERENCE_MAX_CORES 64
+/* Names accepted by coherenceProtocolParse, for usage messages */
+#define COHERENCE_PROTOCOLS "mesi, moesi"
+/* Lines coherenceReport lists as false-sharing hotspots */
+#define COHERENCE_HOTSPOTS 10
+
+typedef enum CoherenceProtocol {
+	COHERENCE_MESI,
+	COHERENCE_MOESI
+} CoherenceProtocol;
+
+typedef struct CoreStats {
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long coherenceMisses;     /* of those, to lines invalidated by others */
+	unsigned long long evictions;
+	unsigned long long writebacks;
+	unsigned long long invalidated;         /* copies lost to other cores' writes */
+} CoreStats;
+
+typedef struct CoherenceStats {
+	unsigned long long invalidations;
+	unsigned long long upgrades;
+	unsigned long long transfers;           /* cache-to-cache */
+	unsigned long long falseSharing;
+	unsigned long long trueSharing;
+	unsigned long long llcHits;
+	unsigned long long llcMisses;
+	unsigned long long memReads;
+	unsigned long long memWrites;
+} CoherenceStats;
+
+typedef struct Coherence Coherence;
+
+/* Returns 0 for an unknown name */
+int coherenceProtocolParse(const char *name, CoherenceProtocol *protocol);
+
+/*
+ * coherenceCreate - cores private caches of geometry core, replaced
+ *                   with the named policy, over an LLC of geometry llc
+ *                   (NULL for none, straight to memory). The LLC's
+ *                   blocks must be the cores' size. Returns NULL for an
+ *                   invalid configuration or when out of memory.
+ */
+Coherence *coherenceCreate(int cores, const LevelConfig *core, const LevelConfig *llc,
+	CoherenceProtocol protocol, const char *policyName);
+
+/*
+ * coherenceAccess - Simulate a load or store of size bytes at addr (the
+ *                   part within its block) by core. Returns 1 on a hit
+ *                   in the core's cache.
+ */
+int coherenceAccess(Coherence *coherence, int core, unsigned long long addr,
+	int isWrite, int size);
+
+const CoreStats *coherenceCoreStats(const Coherence *coherence, int core);
+
+const CoherenceStats *coherenceStats(const Coherence *coherence);
+
+/* Print a line per core, the coherence traffic and the worst false-sharing lines */
+void coherenceReport(Coherence *coherence, FILE *out);
+
+void coherenceFree(Coherence *coherence);
+
+#endif /* COHERENCE_H */
@@ -3,316 +3,808 @@
  *
  * The simulator accepts memory trace and outputs the number of
  * hits, misses, evictions, dirty bytes evicted and dirty bytes in cache.
+ * The simulation itself lives in the reentrant library in sim.c; this
+ * is its command line driver.
  *
  * Author: enhanc
  */
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
 #include <unistd.h>
 #include <getopt.h>
-#include <limits.h>
 
 #include "cachelab.h"
-
-typedef struct CacheLine {
-	int dirtyFlag;
-	int validFlag;
-	unsigned long long tag;
-	int lruCounter;
-} CacheLine;
-
-typedef struct Result {
-	int hits;
-	int misses;
-	int evictions;
-	int totalDirtyCount;
-	int evictedDirtyCount;
-} Result;
-
-char *tracePtr;
-int s;
-int b;
-int E;
-int verboseFlag = 0;
-int timeStamp = 0;
-
-void parseInput(int argc, char **argv);
-CacheLine **initCache();
-Result *startTrace(CacheLine **cache);
-void readCache(unsigned long long addr, CacheLine **cache, Result *result);
-void writeCache(unsigned long long addr, CacheLine **cache, Result *result);
-unsigned long long getTag(unsigned long long addr);
-int getSet(unsigned long long addr);
-void freeCache(CacheLine **cache);
-void freeResult(Result *result);
+#include "tracereader.h"
+#include "sim.h"
+#include "policy.h"
+#include "stackdist.h"
+#include "hierarchy.h"
+#include "prefetch.h"
+#include "coherence.h"
+
+/* Most values a -s, -E or -b list may hold in sweep mode */
+#define MAX_SWEEP 64
+/* Most -R address ranges */
+#define MAX_REGIONS 16
+/* -w write policies, as write-back or -through then allocate or not */
+#define WRITE_POLICY_NAMES "wb-alloc, wb-noalloc, wt-alloc, wt-noalloc"
+/* Cycles per page table level read in a walk unless -W says otherwise */
+#define WALK_CYCLES 30
+/* Accesses a prefetch takes to arrive unless -l says otherwise */
+#define PREFETCH_LATENCY 20
+/* Characters a -R region name may use */
+#define REGION_NAME_CHARS "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_.-"
+
+/* Command line settings */
+typedef struct Options {
+	char *tracePtr;
+	char *policyName;
+	char *sSpec;
+	char *ESpec;
+	char *bSpec;
+	int s;
+	int E;
+	int b;
+	int verboseFlag;
+	int splitFlag;
+	int classifyFlag;
+	char *heatmapPath;
+	SimRegion regions[MAX_REGIONS];
+	int regionCount;
+	int interval;
+	char *intervalPath;
+	int sampleSets;
+	char *prefetchSpec;
+	int prefetchLatency;
+	char *writePolicyName;
+	int victimLines;
+	int combineLines;
+	TlbConfig tlb;
+	int tlbFlag;
+	int sweepFlag;
+	int threadCount;
+	LevelConfig levels[MAX_LEVELS];
+	int levelCount;
+	char *inclusionName;
+	int memCycles;
+	int coreCount;
+	char *protocolName;
+} Options;
+
+/* Where probeHierarchy sends accesses */
+typedef struct HierarchyTarget {
+	Hierarchy *hierarchy;
+	const Options *options;
+} HierarchyTarget;
+
+void parseInput(int argc, char **argv, Options *options);
+void printUsage(char *cmd);
+int parseList(const char *spec, int *values);
+int runSweep(const Options *options);
+int runHierarchy(const Options *options);
+int runCoherence(const Options *options);
+void probeHierarchy(void *target, char op, unsigned long long addr);
+void printAccess(void *ctx, char op, unsigned long long addr, SimOutcome outcome);
+void printClasses(Sim *sim, const SimStats *stats, int perSet);
+int writeHeatmap(Sim *sim, const Options *options);
+int parseWritePolicy(const char *name, SimConfig *config);
+void writeInterval(void *ctx, unsigned long long now, const SimStats *delta);
+void printEstimate(Sim *sim, const SimStats *stats);
 
 int main(int argc, char **argv) {
+        Options options = {
+        	.policyName = "lru",
+        	.threadCount = 1,
+        	.inclusionName = "nine",
+        	.memCycles = 100,
+        	.protocolName = "mesi",
+        	.prefetchLatency = PREFETCH_LATENCY,
+        	.tlb = {
+        		.pageBits = 12,
+        		.mapping = TLB_MAP_NONE,
+        		.walkCycles = WALK_CYCLES,
+        		.seed = 15213
+        	}
+        };
+
+        parseInput(argc, argv, &options);
+
+        if (options.sweepFlag) {
+        	return runSweep(&options);
+        }
+        if (options.coreCount) {
+        	return runCoherence(&options);
+        }
+        if (options.levelCount) {
+        	return runHierarchy(&options);
+        }
+
+        FILE *intervalFile = NULL;
+        if (options.interval > 0) {
+        	intervalFile = options.intervalPath ? fopen(options.intervalPath, "w") : stdout;
+        	if (!intervalFile) {
+        		fprintf(stderr, "Unable to write %s\n", options.intervalPath);
+        		return 1;
+        	}
+        	// line buffered, so the file can be followed as the trace replays
+        	setvbuf(intervalFile, NULL, _IOLBF, 0);
+        	fprintf(intervalFile, "accesses,hits,misses,evictions,dirty_bytes_in_cache,"
+        		"dirty_bytes_evicted,compulsory,capacity,conflict\n");
+        }
+
+        SimConfig config = {
+        	.s = options.s,
+        	.E = options.E,
+        	.b = options.b,
+        	.policy = options.policyName,
+        	.threads = options.threadCount,
+        	.split = options.splitFlag,
+        	.classify = options.classifyFlag,
+        	.perSet = options.heatmapPath != NULL,
+        	.regions = options.regions,
+        	.regionCount = options.regionCount,
+        	.interval = options.interval,
+        	.snapshot = writeInterval,
+        	.snapshotCtx = intervalFile,
+        	.sampleSets = options.sampleSets,
+        	.prefetch = options.prefetchSpec,
+        	.prefetchLatency = options.prefetchLatency,
+        	.victimLines = options.victimLines,
+        	.combineLines = options.combineLines,
+        	.tlb = options.tlbFlag ? &options.tlb : NULL,
+        	.observer = options.verboseFlag ? printAccess : NULL
+        };
+        if (options.writePolicyName && !parseWritePolicy(options.writePolicyName, &config)) {
+        	fprintf(stderr, "Unknown write policy %s\n", options.writePolicyName);
+        	printUsage(argv[0]);
+        	return 1;
+        }
+        Sim *sim = simCreate(&config);
+        if (!sim) {
+        	fprintf(stderr, "Unable to simulate s=%d E=%d b=%d with policy %s%s%s\n",
+        		options.s, options.E, options.b, options.policyName,
+        		options.prefetchSpec ? " and prefetcher " : "",
+        		options.prefetchSpec ? options.prefetchSpec : "");
+        	printUsage(argv[0]);
+        	return 1;
+        }
 
-        parseInput(argc, argv);
-        
-        CacheLine **cache = initCache();
-        if (!cache) {
-        	freeCache(cache);
-        	return 0;
+        if (options.tracePtr && !simReplay(sim, options.tracePtr)) {
+        	fprintf(stderr, "Unable to read %s\n", options.tracePtr);
+        	simDestroy(sim);
+        	return 1;
+        }
+        if (options.tracePtr) {
+        	SimStats stats;
+        	simStats(sim, &stats);
+        	if (options.sampleSets > 1) {
+        		printEstimate(sim, &stats);
+        	} else {
+        		printSummary(stats.hits,
+        			stats.misses,
+        			stats.evictions,
+        			stats.dirtyBytesInCache,
+        			stats.dirtyBytesEvicted);
+        	}
+        	if (options.prefetchSpec) {
+        		printf("prefetch issued:%llu useful:%llu late:%llu polluting:%llu\n",
+        			stats.prefetchIssued, stats.prefetchUseful, stats.prefetchLate,
+        			stats.prefetchPolluting);
+        	}
+        	if (options.writePolicyName || options.victimLines || options.combineLines) {
+        		// without -V and -B, traffic is per set and scales like the misses
+        		unsigned long long scale = options.sampleSets > 1 ? options.sampleSets : 1;
+        		printf("victim_hits:%llu mem_read_bytes:%llu mem_write_bytes:%llu\n",
+        			stats.victimHits, stats.memReadBytes * scale, stats.memWriteBytes * scale);
+        	}
+        	if (options.tlbFlag) {
+        		tlbReport(simTlb(sim), stdout);
+        	}
+        	if (options.classifyFlag) {
+        		printClasses(sim, &stats, options.verboseFlag);
+        	}
+        	if (options.heatmapPath && !writeHeatmap(sim, &options)) {
+        		fprintf(stderr, "Unable to write %s\n", options.heatmapPath);
+        		simDestroy(sim);
+        		return 1;
+        	}
         }
-        
-        Result *result = startTrace(cache);
-
-        if (result) {
-        	int dirtyBytesInCache = (1 << b) * ((result->totalDirtyCount) - (result->evictedDirtyCount));
-        	int dirtyBytesEvicted = (1 << b) * (result->evictedDirtyCount);
-
-        	printSummary(result->hits, 
-        		result->misses, 
-        		result->evictions, 
-        		dirtyBytesInCache,
-        		dirtyBytesEvicted);
+        simDestroy(sim);
+        if (intervalFile && intervalFile != stdout) {
+        	fclose(intervalFile);
         }
-        freeCache(cache);
-        freeResult(result);
         return 0;
 }
 
-void parseInput(int argc, char **argv) {
+void parseInput(int argc, char **argv, Options *options) {
 	int opt = 0;
-	while((opt = getopt(argc, argv, "hvs:E:b:t:")) != -1) {
+	while((opt = getopt(argc, argv, "hvaCs:E:b:t:p:Dj:L:I:c:H:R:i:o:S:P:l:w:V:B:T:G:m:W:n:k:")) != -1) {
 		switch (opt) {
 			case 'v':
-			verboseFlag = 1;
+			options->verboseFlag = 1;
+			break;
+			case 'a':
+			options->splitFlag = 1;
+			break;
+			case 'C':
+			options->classifyFlag = 1;
+			break;
+			case 'H':
+			options->heatmapPath = optarg;
+			break;
+			case 'i':
+			options->interval = atoi(optarg);
+			break;
+			case 'o':
+			options->intervalPath = optarg;
+			break;
+			case 'S':
+			options->sampleSets = atoi(optarg);
+			break;
+			case 'P':
+			options->prefetchSpec = optarg;
+			break;
+			case 'l':
+			options->prefetchLatency = atoi(optarg);
+			break;
+			case 'w':
+			options->writePolicyName = optarg;
+			break;
+			case 'V':
+			options->victimLines = atoi(optarg);
+			break;
+			case 'B':
+			options->combineLines = atoi(optarg);
+			break;
+			case 'T':
+			if (options->tlb.levelCount == TLB_MAX_LEVELS ||
+				!tlbLevelParse(optarg, &options->tlb.levels[options->tlb.levelCount])) {
+				printUsage(argv[0]);
+				exit(1);
+			}
+			options->tlb.levelCount++;
+			options->tlbFlag = 1;
+			break;
+			case 'G':
+			if (!tlbPageParse(optarg, &options->tlb.pageBits)) {
+				printUsage(argv[0]);
+				exit(1);
+			}
+			options->tlbFlag = 1;
+			break;
+			case 'm':
+			if (!tlbMappingParse(optarg, &options->tlb.mapping)) {
+				printUsage(argv[0]);
+				exit(1);
+			}
+			options->tlbFlag = 1;
+			break;
+			case 'W':
+			options->tlb.walkCycles = atoi(optarg);
+			options->tlbFlag = 1;
+			break;
+			case 'n':
+			options->coreCount = atoi(optarg);
+			if (options->coreCount < 1 || options->coreCount > COHERENCE_MAX_CORES) {
+				printUsage(argv[0]);
+				exit(1);
+			}
+			break;
+			case 'k':
+			options->protocolName = optarg;
+			break;
+			case 'R':
+			if (options->regionCount == MAX_REGIONS ||
+				!simRegionParse(optarg, &options->regions[options->regionCount]) ||
+				// names go into the -H file unquoted
+				strspn(options->regions[options->regionCount].name, REGION_NAME_CHARS) !=
+				strlen(options->regions[options->regionCount].name)) {
+				printUsage(argv[0]);
+				exit(1);
+			}
+			options->regionCount++;
 			break;
 			case 's':
-			s = atoi(optarg);
+			options->s = atoi(optarg);
+			options->sSpec = optarg;
 			break;
 			case 'E':
-			E = atoi(optarg);
+			options->E = atoi(optarg);
+			options->ESpec = optarg;
 			break;
 			case 'b':
-			b = atoi(optarg);
+			options->b = atoi(optarg);
+			options->bSpec = optarg;
+			break;
+			case 'D':
+			options->sweepFlag = 1;
+			break;
+			case 'j':
+			options->threadCount = atoi(optarg);
+			break;
+			case 'L':
+			if (options->levelCount == MAX_LEVELS ||
+				!levelParse(optarg, &options->levels[options->levelCount])) {
+				printUsage(argv[0]);
+				exit(1);
+			}
+			options->levelCount++;
+			break;
+			case 'I':
+			options->inclusionName = optarg;
+			break;
+			case 'c':
+			options->memCycles = atoi(optarg);
 			break;
 			case't':
-			tracePtr = optarg;
+			options->tracePtr = optarg;
+			break;
+			case 'p':
+			options->policyName = optarg;
 			break;
 			case'h':
+			printUsage(argv[0]);
+			exit(0);
 			default:
-			//help
-			break;
+			printUsage(argv[0]);
+			exit(1);
 		}
 	}
+	if (options->tlbFlag && options->tlb.levelCount == 0) {
+		// a typical L1 data TLB backed by a unified L2 TLB
+		TlbLevelConfig defaults[2] = {{64, 4, 1}, {1536, 12, 7}};
+		memcpy(options->tlb.levels, defaults, sizeof(defaults));
+		options->tlb.levelCount = 2;
+	}
+	if (options->prefetchSpec && options->sampleSets > 1) {
+		fprintf(stderr, "-P prefetches into other sets than the access, so it cannot "
+			"be combined with -S\n");
+		exit(1);
+	}
+	if ((options->victimLines || options->combineLines) && options->sampleSets > 1) {
+		fprintf(stderr, "-V and -B are shared by every set, so they cannot be "
+			"combined with -S\n");
+		exit(1);
+	}
+	if (options->regionCount && options->tlbFlag && options->tlb.mapping != TLB_MAP_NONE) {
+		fprintf(stderr, "-R ranges are virtual, so they cannot be combined with -m %s\n",
+			options->tlb.mapping == TLB_MAP_RANDOM ? "random" : "color");
+		exit(1);
+	}
 	return;
 } 
 
-CacheLine **initCache() {
-	CacheLine **cache = (CacheLine **) calloc(1 << s, sizeof(CacheLine*));
-	
-	if(!cache) {
-		return NULL;
+void printUsage(char *cmd) {
+	printf("Usage: %s [-hvaCD] -s <s> -E <E> -b <b> -t <tracefile> [-p <policy>] [-j <n>]\n", cmd);
+	printf("  -h            Print this help message\n");
+	printf("  -v            Print a line per access\n");
+	printf("  -a            Probe every block an access touches and replay M as a\n");
+	printf("                load then a store (not applied by -D)\n");
+	printf("  -C            Classify misses as compulsory, capacity or conflict;\n");
+	printf("                with -v, per set too\n");
+	printf("  -H <file>     Write per-set and per-region counters to file, as JSON\n");
+	printf("                if it ends in .json and CSV otherwise\n");
+	printf("  -R <n:lo-hi>  Count addresses lo (inclusive) to hi (exclusive), in hex,\n");
+	printf("                as region n in the -H file; repeatable\n");
+	printf("  -i <n>        Every n accesses, write the change in each counter as a\n");
+	printf("                CSV line (dirty bytes in cache as it stands)\n");
+	printf("  -o <file>     File for the -i lines (default stdout)\n");
+	printf("  -S <k>        Simulate one set in k (a power of two) and print totals\n");
+	printf("                scaled up, then 95%% confidence intervals; -C, -H, -i\n");
+	printf("                and -v only see the sampled sets\n");
+	printf("  -P <spec>     Prefetch with %s\n", PREFETCH_NAMES);
+	printf("                and print issued, useful, late and polluting counts\n");
+	printf("  -l <n>        Accesses a prefetch takes to arrive: a prefetched line\n");
+	printf("                used sooner counts as late (default %d)\n", PREFETCH_LATENCY);
+	printf("  -w <policy>   Write policy: %s (default wb-alloc)\n",
+		WRITE_POLICY_NAMES);
+	printf("  -V <n>        Add an n line fully associative victim cache\n");
+	printf("  -B <n>        Merge stores to memory in an n entry write-combining buffer\n");
+	printf("                (with -w, -V or -B, victim hits and memory traffic printed)\n");
+	printf("  -T <n:w:c>    Add a TLB level (L1 first) of n entries, w ways and c cycles\n");
+	printf("                per hit (default 64:4:1 then 1536:12:7); with -T, -G, -m\n");
+	printf("                or -W, TLB statistics are printed\n");
+	printf("  -G <size>     Page size, such as 4K or 2M (default 4K)\n");
+	printf("  -m <mapping>  Virtual to physical pages: %s (default none)\n",
+		TLB_MAPPING_NAMES);
+	printf("  -W <cycles>   Cycles per page table level in a walk (default %d)\n", WALK_CYCLES);
+	printf("  -s <s>        Number of set index bits\n");
+	printf("  -E <E>        Number of lines per set\n");
+	printf("  -b <b>        Number of block offset bits\n");
+	printf("  -t <file>     Trace to replay, text or binary (- for stdin)\n");
+	printf("  -p <policy>   Replacement policy: %s (default lru)\n", POLICY_NAMES);
+	printf("  -j <n>        Simulate with n threads, each owning a range of sets\n");
+	printf("  -L <s:E:b:c>  Add a cache level (L1 first) with c cycles per hit;\n");
+	printf("                with -L, -s/-E/-b are ignored and per-level stats printed\n");
+	printf("  -I <policy>   Inclusion between levels: %s (default nine)\n", INCLUSION_NAMES);
+	printf("  -c <cycles>   Cycles per memory access for -L (default 100)\n");
+	printf("  -n <cores>    Simulate n coherent private -s/-E/-b caches, one per trace\n");
+	printf("                core id (modulo n), over the -L level as a shared LLC\n");
+	printf("  -k <protocol> Coherence protocol for -n: %s (default mesi)\n",
+		COHERENCE_PROTOCOLS);
+	printf("  -D            Sweep: -s, -E and -b take lists such as 0-4,8 and every\n");
+	printf("                combination is simulated (LRU) in one pass over the trace\n");
+}
+
+/*
+ * parseList - Parse a comma separated list of numbers and lo-hi ranges
+ *             into values. Returns the count, or 0 if spec is malformed.
+ */
+int parseList(const char *spec, int *values) {
+	int count = 0;
+	char *end;
+
+	if (!spec) {
+		return 0;
 	}
-	int i;
-	for (i = 0; i < (1 << s); i++ ) {
-		cache[i] = (CacheLine*) calloc( E, sizeof(CacheLine));
-		if (!cache[i]) {
-			return NULL;
+	for (;;) {
+		long lo = strtol(spec, &end, 10);
+		long hi = lo;
+		if (end == spec || lo < 0) {
+			return 0;
+		}
+		if (*end == '-') {
+			spec = end + 1;
+			hi = strtol(spec, &end, 10);
+			if (end == spec || hi < lo) {
+				return 0;
+			}
+		}
+		for (; lo <= hi; lo++) {
+			if (count == MAX_SWEEP) {
+				return 0;
+			}
+			values[count++] = (int) lo;
+		}
+		if (*end == '\0') {
+			return count;
 		}
+		if (*end != ',') {
+			return 0;
+		}
+		spec = end + 1;
 	}
-	return cache;
 }
 
-Result *startTrace(CacheLine **cache) {
-	FILE *fptr = fopen(tracePtr, "r");
+/*
+ * runSweep - Simulate every (s, E, b) from the -s, -E and -b lists with
+ *            LRU replacement in a single pass over the trace.
+ */
+int runSweep(const Options *options) {
+	int sList[MAX_SWEEP];
+	int EList[MAX_SWEEP];
+	int bList[MAX_SWEEP];
+	int sCount = parseList(options->sSpec, sList);
+	int ECount = parseList(options->ESpec, EList);
+	int bCount = parseList(options->bSpec, bList);
+	int maxE = 0;
+	int i;
 
-	if (!fptr) {
-		return NULL;
+	if (!sCount || !ECount || !bCount || !options->tracePtr) {
+		fprintf(stderr, "Sweep mode needs -s, -E, -b lists and -t\n");
+		return 1;
 	}
-
-	Result *result = (Result*) calloc(1, sizeof(Result));
-
-	if (!result) {
-		return NULL;
+	for (i = 0; i < ECount; i++) {
+		if (EList[i] > maxE) {
+			maxE = EList[i];
+		}
 	}
 
-	char op;
-	unsigned long long addr;
-	int size;
+	TraceReader *reader = traceOpen(options->tracePtr);
+	StackSweep *sweep = sweepCreate(sList, sCount, bList, bCount, maxE);
+	TraceRecord *batch = (TraceRecord*) malloc(TRACE_BATCH * sizeof(TraceRecord));
+	if (!reader || !sweep || !batch) {
+		fprintf(stderr, "Unable to start the sweep over %s\n", options->tracePtr);
+		traceClose(reader);
+		sweepFree(sweep);
+		free(batch);
+		return 1;
+	}
 
-	while (fscanf(fptr, " %c %llx %d", &op, &addr, &size) > 0) {
-		++timeStamp;
-		switch(op) {
-			case 'L':
-			readCache(addr,cache,result);
-			break;
-			case 'S':
-			writeCache(addr,cache,result);
-			break;
-			default:
-			break;
+	size_t count;
+	size_t j;
+	int swept = 1;
+	while (swept && (count = traceRead(reader, batch, TRACE_BATCH)) > 0) {
+		for (j = 0; swept && j < count; j++) {
+			if (batch[j].op == 'L' || batch[j].op == 'S') {
+				swept = sweepAccess(sweep, batch[j].addr);
+			}
 		}
 	}
+	if (swept) {
+		sweepReport(sweep, EList, ECount, stdout);
+	} else {
+		fprintf(stderr, "Out of memory sweeping %s\n", options->tracePtr);
+	}
 
-	fclose(fptr);
-
-	return result;
+	free(batch);
+	sweepFree(sweep);
+	traceClose(reader);
+	return !swept;
 }
 
-void readCache(unsigned long long addr, CacheLine **cache, Result *result) {
-	int setIndex = getSet(addr);
-	unsigned long long tag = getTag(addr);
-	int i;
+/*
+ * runHierarchy - Replay the trace through the -L levels and report each
+ *                level's statistics and the average access time.
+ */
+int runHierarchy(const Options *options) {
+	Inclusion inclusion;
+	if (!inclusionParse(options->inclusionName, &inclusion)) {
+		fprintf(stderr, "Unknown inclusion policy %s\n", options->inclusionName);
+		return 1;
+	}
+	if (!options->tracePtr) {
+		fprintf(stderr, "Missing required command line argument -t\n");
+		return 1;
+	}
 
-	for (i = 0; i < E; i ++) {
-		// check for hit
-		if (cache[setIndex][i].validFlag && 
-			cache[setIndex][i].tag == tag) {
-			cache[setIndex][i].lruCounter = timeStamp;
-			++(result->hits); 
-			if (verboseFlag) {
-				printf("L %llx hit\n", addr);
-			}
-			return;
-		} 
-	}
-
-	// check for cold miss
-	for (i = 0; i < E; i++) {
-		if (cache[setIndex][i].validFlag == 0) {
-			cache[setIndex][i].validFlag = 1;
-			cache[setIndex][i].tag = tag;
-			cache[setIndex][i].lruCounter = timeStamp;
-			cache[setIndex][i].dirtyFlag = 0;
-			++(result->misses);
-			if (verboseFlag) {
-				printf("L %llx miss\n", addr);
+	Hierarchy *hierarchy = hierarchyCreate(options->levels, options->levelCount,
+		inclusion, options->policyName, options->memCycles);
+	if (!hierarchy) {
+		fprintf(stderr, "Invalid hierarchy: check the -p policy and that block "
+			"sizes do not shrink going down (nor change, if exclusive)\n");
+		return 1;
+	}
+	HierarchyTarget target = {hierarchy, options};
+	TraceReader *reader = traceOpen(options->tracePtr);
+	TraceRecord *batch = (TraceRecord*) malloc(TRACE_BATCH * sizeof(TraceRecord));
+	if (!reader || !batch) {
+		fprintf(stderr, "Unable to read %s\n", options->tracePtr);
+		traceClose(reader);
+		hierarchyFree(hierarchy);
+		free(batch);
+		return 1;
+	}
+
+	size_t count;
+	size_t i;
+	while ((count = traceRead(reader, batch, TRACE_BATCH)) > 0) {
+		for (i = 0; i < count; i++) {
+			if (options->splitFlag && simNeedsSplit(&batch[i], options->levels[0].b)) {
+				simSplit(&batch[i], options->levels[0].b, probeHierarchy, &target);
+			} else if (batch[i].op == 'L' || batch[i].op == 'S') {
+				probeHierarchy(&target, batch[i].op, batch[i].addr);
 			}
-			return;
 		}
 	}
+	hierarchyReport(hierarchy, stdout);
 
-	// conflict miss
-	int minUseIndex = -1;
-	int minUseCount = INT_MAX;
-	for (i = 0; i < E; i++) {
-		if (cache[setIndex][i].lruCounter < minUseCount) {
-			minUseCount = cache[setIndex][i].lruCounter;
-			minUseIndex = i;
-		}
+	free(batch);
+	traceClose(reader);
+	hierarchyFree(hierarchy);
+	return 0;
+}
+
+void probeHierarchy(void *target, char op, unsigned long long addr) {
+	const HierarchyTarget *hierarchyTarget = (const HierarchyTarget*) target;
+	int served = hierarchyAccess(hierarchyTarget->hierarchy, addr, op == 'S');
+	if (!hierarchyTarget->options->verboseFlag) {
+		return;
 	}
-	if (minUseIndex >= 0) {
-		if(cache[setIndex][minUseIndex].dirtyFlag) {
-			cache[setIndex][minUseIndex].dirtyFlag = 0;
-			++(result->evictedDirtyCount);
-		}
-		cache[setIndex][minUseIndex].validFlag = 1;
-		cache[setIndex][minUseIndex].tag = tag;
-		cache[setIndex][minUseIndex].lruCounter = timeStamp;
-		++(result->evictions);
-		++(result->misses);
-		if (verboseFlag) {
-			printf("L %llx miss eviction\n", addr);
-		}
+	if (served < hierarchyTarget->options->levelCount) {
+		printf("%c %llx hit L%d\n", op, addr, served + 1);
+	} else {
+		printf("%c %llx miss\n", op, addr);
 	}
-	return;
 }
 
+/*
+ * runCoherence - Replay the trace through -n coherent private caches,
+ *                each record on the cache of its core, and report the
+ *                coherence traffic. An M record is a load then a store.
+ */
+int runCoherence(const Options *options) {
+	CoherenceProtocol protocol;
+	if (!coherenceProtocolParse(options->protocolName, &protocol)) {
+		fprintf(stderr, "Unknown coherence protocol %s\n", options->protocolName);
+		return 1;
+	}
+	if (!options->tracePtr) {
+		fprintf(stderr, "Missing required command line argument -t\n");
+		return 1;
+	}
+	if (options->levelCount > 1) {
+		fprintf(stderr, "-n takes at most one -L level, the shared LLC\n");
+		return 1;
+	}
 
-void writeCache(unsigned long long addr, CacheLine **cache, Result *result) {
-	int setIndex = getSet(addr);
-	unsigned long long tag = getTag(addr);
-	int i = 0;
+	LevelConfig core = {options->s, options->E, options->b, 0};
+	Coherence *coherence = coherenceCreate(options->coreCount, &core,
+		options->levelCount ? &options->levels[0] : NULL, protocol, options->policyName);
+	if (!coherence) {
+		fprintf(stderr, "Invalid coherence setup: check the -p policy and that the "
+			"LLC block size matches -b\n");
+		return 1;
+	}
+	TraceReader *reader = traceOpen(options->tracePtr);
+	TraceRecord *batch = (TraceRecord*) malloc(TRACE_BATCH * sizeof(TraceRecord));
+	if (!reader || !batch) {
+		fprintf(stderr, "Unable to read %s\n", options->tracePtr);
+		traceClose(reader);
+		coherenceFree(coherence);
+		free(batch);
+		return 1;
+	}
 
-	//write hit: write back
-	for (i = 0; i < E; i++) {
-		if (cache[setIndex][i].validFlag &&
-			cache[setIndex][i].tag == tag) {
-			if (cache[setIndex][i].dirtyFlag == 0) {
-				++(result->totalDirtyCount);
-				cache[setIndex][i].dirtyFlag = 1;
+	size_t count;
+	size_t i;
+	while ((count = traceRead(reader, batch, TRACE_BATCH)) > 0) {
+		for (i = 0; i < count; i++) {
+			const TraceRecord *rec = &batch[i];
+			int index = rec->core % options->coreCount;
+			int pass;
+			if (rec->op != 'L' && rec->op != 'S' && rec->op != 'M') {
+				continue;
 			}
-			cache[setIndex][i].lruCounter = timeStamp;
-			++(result->hits);
-			if (verboseFlag) {
-				printf("S %llx hit\n", addr);
+			for (pass = 0; pass < (rec->op == 'M' ? 2 : 1); pass++) {
+				int isWrite = rec->op == 'S' || pass == 1;
+				int hit = coherenceAccess(coherence, index, rec->addr, isWrite, rec->size);
+				if (options->verboseFlag) {
+					printf("%c %llx core %d %s\n", isWrite ? 'S' : 'L', rec->addr, index,
+						hit ? "hit" : "miss");
+				}
 			}
-			return;
 		}
 	}
+	coherenceReport(coherence, stdout);
 
-	//write miss: write allocate
+	free(batch);
+	traceClose(reader);
+	coherenceFree(coherence);
+	return 0;
+}
 
-	// find empty line to load data into cache
-	for (i = 0; i < E; i++) {
-		if (cache[setIndex][i].validFlag == 0) {
-			cache[setIndex][i].validFlag = 1;
-			cache[setIndex][i].tag = tag;
-			cache[setIndex][i].dirtyFlag = 1;
-			cache[setIndex][i].lruCounter = timeStamp;
-			++(result->misses);
-			++(result->totalDirtyCount);
-			if (verboseFlag) {
-				printf("S %llx miss\n", addr);
-			}
-			return;
-		}
+void printAccess(void *ctx, char op, unsigned long long addr, SimOutcome outcome) {
+	switch (outcome) {
+		case SIM_HIT:
+		printf("%c %llx hit\n", op, addr);
+		break;
+		case SIM_MISS:
+		printf("%c %llx miss\n", op, addr);
+		break;
+		case SIM_EVICTION:
+		printf("%c %llx %s\n", op, addr, op == 'S' ? "miss, eviction" : "miss eviction");
+		break;
 	}
+}
 
-	// no empty line, replace one to make space
-	int minUseIndex = -1;
-	int minUseCount = INT_MAX;
-	for (i = 0; i < E; i++) {
-		if (cache[setIndex][i].lruCounter < minUseCount) {
-			minUseCount = cache[setIndex][i].lruCounter;
-			minUseIndex = i;
-		}
-	}
+/*
+ * printClasses - Print the three-C breakdown of the misses, then with
+ *                perSet one line for each set that missed at all.
+ */
+void printClasses(Sim *sim, const SimStats *stats, int perSet) {
+	size_t set;
 
-	if (minUseIndex >= 0) {
-		if(cache[setIndex][minUseIndex].dirtyFlag) {
-			++(result->evictedDirtyCount);
-			cache[setIndex][minUseIndex].dirtyFlag = 0;
+	printf("compulsory:%llu capacity:%llu conflict:%llu\n",
+		stats->compulsory, stats->capacity, stats->conflict);
+	if (!perSet) {
+		return;
+	}
+	for (set = 0; set < simSetCount(sim); set++) {
+		SimSetStats setStats;
+		if (simSetStats(sim, set, &setStats) &&
+			setStats.compulsory + setStats.capacity + setStats.conflict > 0) {
+			printf("set %zu compulsory:%llu capacity:%llu conflict:%llu\n", set,
+				setStats.compulsory, setStats.capacity, setStats.conflict);
 		}
-		cache[setIndex][minUseIndex].validFlag = 1;
-		cache[setIndex][minUseIndex].tag = tag;
-		cache[setIndex][minUseIndex].lruCounter = timeStamp;
-		cache[setIndex][minUseIndex].dirtyFlag = 1;
-	 	++(result->totalDirtyCount);
-		++(result->evictions);
-		++(result->misses);
-			if (verboseFlag) {
-				printf("S %llx miss, eviction\n", addr);
-			}
 	}
-	return;
-
 }
 
-int getSet(unsigned long long addr) {
-	if (s == 0) {
-		return s;
+/*
+ * parseWritePolicy - Set config's write policy from one of
+ *                    WRITE_POLICY_NAMES. Returns 0 if name is unknown.
+ */
+int parseWritePolicy(const char *name, SimConfig *config) {
+	if (strcmp(name, "wb-alloc") == 0) {
+		config->writeThrough = 0;
+		config->noWriteAllocate = 0;
+	} else if (strcmp(name, "wb-noalloc") == 0) {
+		config->writeThrough = 0;
+		config->noWriteAllocate = 1;
+	} else if (strcmp(name, "wt-alloc") == 0) {
+		config->writeThrough = 1;
+		config->noWriteAllocate = 0;
+	} else if (strcmp(name, "wt-noalloc") == 0) {
+		config->writeThrough = 1;
+		config->noWriteAllocate = 1;
+	} else {
+		return 0;
 	}
-	return ((1 << s) - 1) & (addr >> b);
-}
-
-unsigned long long getTag(unsigned long long addr) {
-	unsigned long long shift = b+s;
-	return ((1LL << (63LL - shift))- 1LL) & (addr >> shift);
+	return 1;
 }
 
-void freeCache(CacheLine** cache) {
-	int i;
-	for (i = 0; i < (1 << s); i++) {
-		if (cache[i]) {
-			free(cache[i]);
+/*
+ * writeHeatmap - Dump the counters of every set and every -R region to
+ *                the -H file. Returns 0 if it cannot be written.
+ */
+int writeHeatmap(Sim *sim, const Options *options) {
+	const char *path = options->heatmapPath;
+	size_t length = strlen(path);
+	int json = length >= 5 && strcmp(path + length - 5, ".json") == 0;
+	FILE *out = fopen(path, "w");
+	size_t set;
+	int r;
+
+	if (!out) {
+		return 0;
+	}
+	if (json) {
+		fprintf(out, "{\n  \"sets\": [");
+	} else {
+		fprintf(out, "kind,id,start,end,hits,misses,evictions,compulsory,capacity,conflict\n");
+	}
+	for (set = 0; set < simSetCount(sim); set++) {
+		SimSetStats stats;
+		simSetStats(sim, set, &stats);
+		if (json) {
+			fprintf(out, "%s\n    {\"set\": %zu, \"hits\": %llu, \"misses\": %llu, "
+				"\"evictions\": %llu, \"compulsory\": %llu, \"capacity\": %llu, "
+				"\"conflict\": %llu}", set ? "," : "", set, stats.hits, stats.misses,
+				stats.evictions, stats.compulsory, stats.capacity, stats.conflict);
+		} else {
+			fprintf(out, "set,%zu,,,%llu,%llu,%llu,%llu,%llu,%llu\n", set, stats.hits,
+				stats.misses, stats.evictions, stats.compulsory, stats.capacity,
+				stats.conflict);
 		}
 	}
-	if (cache) {
-		free(cache);
+	if (json) {
+		fprintf(out, "\n  ],\n  \"regions\": [");
 	}
-}
-
-void freeResult(Result *result) {
-	if (result) {
-		free(result);
+	for (r = 0; r < options->regionCount; r++) {
+		const SimRegion *region = &options->regions[r];
+		SimRegionStats stats;
+		simRegionStats(sim, r, &stats);
+		if (json) {
+			fprintf(out, "%s\n    {\"name\": \"%s\", \"start\": \"0x%llx\", "
+				"\"end\": \"0x%llx\", \"hits\": %llu, \"misses\": %llu, "
+				"\"evictions\": %llu, \"compulsory\": %llu, \"capacity\": %llu, "
+				"\"conflict\": %llu}", r ? "," : "", region->name, region->start,
+				region->end, stats.hits, stats.misses, stats.evictions,
+				stats.compulsory, stats.capacity, stats.conflict);
+		} else {
+			fprintf(out, "region,%s,0x%llx,0x%llx,%llu,%llu,%llu,%llu,%llu,%llu\n",
+				region->name, region->start, region->end, stats.hits, stats.misses,
+				stats.evictions, stats.compulsory, stats.capacity, stats.conflict);
+		}
+	}
+	if (json) {
+		fprintf(out, "\n  ]\n}\n");
 	}
+	return fclose(out) == 0;
 }
 
+/* writeInterval - SimSnapshot writing one CSV line of -i output to ctx */
+void writeInterval(void *ctx, unsigned long long now, const SimStats *delta) {
+	fprintf((FILE *) ctx, "%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", now,
+		delta->hits, delta->misses, delta->evictions, delta->dirtyBytesInCache,
+		delta->dirtyBytesEvicted, delta->compulsory, delta->capacity, delta->conflict);
+}
 
-
+/*
+ * printEstimate - printSummary with every count scaled up from the -S
+ *                 sampled sets, then the estimates' confidence intervals
+ */
+void printEstimate(Sim *sim, const SimStats *stats) {
+	SimEstimate estimate;
+
+	simEstimate(sim, &estimate);
+	double scale = (double) estimate.sets / estimate.sampledSets;
+	printSummary(llround(estimate.hits),
+		llround(estimate.misses),
+		llround(estimate.evictions),
+		llround(stats->dirtyBytesInCache * scale),
+		llround(stats->dirtyBytesEvicted * scale));
+	if (estimate.activeSets < SIM_MIN_ACTIVE_SETS) {
+		printf("sampled %zu of %zu sets, only %zu with accesses: too few for "
+			"95%% intervals (need %d), miss_rate %.4f\n", estimate.sampledSets,
+			estimate.sets, estimate.activeSets, SIM_MIN_ACTIVE_SETS, estimate.missRate);
+		return;
+	}
+	printf("sampled %zu of %zu sets, 95%% intervals: hits +-%.0f misses +-%.0f "
+		"evictions +-%.0f miss_rate %.4f +-%.4f\n", estimate.sampledSets,
+		estimate.sets, estimate.hitsError, estimate.missesError,
+		estimate.evictionsError, estimate.missRate, estimate.missRateError);
+}
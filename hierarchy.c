@@ -0,0 +1,307 @@
+/*
+ * hierarchy.c - Multi-level cache hierarchy (L1, L2, ..., LLC)
+ *
+ * Each level is an ordinary set-major Cache with its own replacement
+ * policy; this file only moves blocks between them.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "hierarchy.h"
+#include "cache.h"
+#include "policy.h"
+
+typedef struct Level {
+	Cache *cache;
+	Policy *policy;
+	int latency;
+	LevelStats stats;
+} Level;
+
+struct Hierarchy {
+	Level levels[MAX_LEVELS];
+	int count;
+	Inclusion inclusion;
+	int memLatency;
+	int now;                /* policy clock, see policy.h */
+	unsigned long long accesses;
+	unsigned long long memReads;
+	unsigned long long memWrites;
+};
+
+static size_t setOf(const Cache *cache, unsigned long long addr) {
+	return (size_t) (addr >> cache->b) & (cache->sets - 1);
+}
+
+static unsigned long long tagOf(const Cache *cache, unsigned long long addr) {
+	return addr >> (cache->b + cache->s);
+}
+
+static unsigned long long blockAddr(const Cache *cache, size_t set, int way) {
+	unsigned long long tag = cacheTags(cache, set)[way];
+	return ((tag << cache->s) | set) << cache->b;
+}
+
+/* Way of level holding addr, or -1; *set receives addr's set either way */
+static int lookup(const Level *level, unsigned long long addr, size_t *set) {
+	*set = setOf(level->cache, addr);
+	return cacheFindWay(level->cache, *set, tagOf(level->cache, addr));
+}
+
+static void invalidate(Level *level, size_t set, int way) {
+	cacheClearBit(level->cache->valid, level->cache, set, way);
+	cacheClearBit(level->cache->dirty, level->cache, set, way);
+}
+
+/*
+ * writeBack - Mark the block at addr dirty in the first level from
+ *             index from down that holds it, or write it to memory.
+ */
+static void writeBack(Hierarchy *hierarchy, int from, unsigned long long addr) {
+	int i;
+	for (i = from; i < hierarchy->count; i++) {
+		Level *level = &hierarchy->levels[i];
+		size_t set;
+		int way = lookup(level, addr, &set);
+		if (way >= 0) {
+			cacheSetBit(level->cache->dirty, level->cache, set, way);
+			return;
+		}
+	}
+	hierarchy->memWrites++;
+}
+
+static void fill(Hierarchy *hierarchy, int index, unsigned long long addr, int dirty);
+
+/*
+ * evicted - Dispose of a block pushed out of level index, as the
+ *           inclusion policy requires.
+ */
+static void evicted(Hierarchy *hierarchy, int index, unsigned long long addr, int dirty) {
+	int i;
+
+	switch (hierarchy->inclusion) {
+		case INCLUSION_INCLUSIVE:
+		for (i = 0; i < index; i++) {
+			Level *upper = &hierarchy->levels[i];
+			Cache *lower = hierarchy->levels[index].cache;
+			unsigned long long sub;
+			// the evicted block may span several smaller upper blocks
+			for (sub = 0; sub >> lower->b == 0; sub += 1ULL << upper->cache->b) {
+				size_t set;
+				int way = lookup(upper, addr + sub, &set);
+				if (way >= 0) {
+					dirty |= cacheTestBit(upper->cache->dirty, upper->cache, set, way);
+					invalidate(upper, set, way);
+					upper->stats.backInvalidations++;
+				}
+			}
+		}
+		if (dirty) {
+			writeBack(hierarchy, index + 1, addr);
+		}
+		break;
+		case INCLUSION_EXCLUSIVE:
+		if (index + 1 < hierarchy->count) {
+			fill(hierarchy, index + 1, addr, dirty);
+		} else if (dirty) {
+			hierarchy->memWrites++;
+		}
+		break;
+		case INCLUSION_NINE:
+		if (dirty) {
+			writeBack(hierarchy, index + 1, addr);
+		}
+		break;
+	}
+}
+
+/* fill - Install the block at addr in level index, evicting if full */
+static void fill(Hierarchy *hierarchy, int index, unsigned long long addr, int dirty) {
+	Level *level = &hierarchy->levels[index];
+	Cache *cache = level->cache;
+	size_t set = setOf(cache, addr);
+	int way = cacheFindInvalid(cache, set);
+
+	if (way >= 0) {
+		cacheSetBit(cache->valid, cache, set, way);
+	} else {
+		way = level->policy->victim(level->policy, cache, set);
+		unsigned long long victim = blockAddr(cache, set, way);
+		int victimDirty = cacheTestBit(cache->dirty, cache, set, way);
+		level->stats.evictions++;
+		level->stats.dirtyEvictions += victimDirty;
+		invalidate(level, set, way);
+		evicted(hierarchy, index, victim, victimDirty);
+		cacheSetBit(cache->valid, cache, set, way);
+	}
+
+	cacheTags(cache, set)[way] = tagOf(cache, addr);
+	if (dirty) {
+		cacheSetBit(cache->dirty, cache, set, way);
+	}
+	level->policy->onFill(level->policy, cache, set, way, hierarchy->now);
+}
+
+int levelParse(const char *spec, LevelConfig *config) {
+	int *fields[4] = {&config->s, &config->E, &config->b, &config->latency};
+	int i;
+	for (i = 0; i < 4; i++) {
+		char *end;
+		long value = strtol(spec, &end, 10);
+		if (end == spec || value < 0 || *end != (i < 3 ? ':' : '\0')) {
+			return 0;
+		}
+		*fields[i] = (int) value;
+		spec = end + 1;
+	}
+	return config->E > 0;
+}
+
+int inclusionParse(const char *name, Inclusion *inclusion) {
+	if (strcmp(name, "inclusive") == 0) {
+		*inclusion = INCLUSION_INCLUSIVE;
+	} else if (strcmp(name, "exclusive") == 0) {
+		*inclusion = INCLUSION_EXCLUSIVE;
+	} else if (strcmp(name, "nine") == 0) {
+		*inclusion = INCLUSION_NINE;
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+Hierarchy *hierarchyCreate(const LevelConfig *levels, int count,
+	Inclusion inclusion, const char *policyName, int memLatency) {
+	int i;
+
+	if (count < 1 || count > MAX_LEVELS) {
+		return NULL;
+	}
+	for (i = 1; i < count; i++) {
+		if (levels[i].b < levels[i - 1].b ||
+			(inclusion == INCLUSION_EXCLUSIVE && levels[i].b != levels[i - 1].b)) {
+			return NULL;
+		}
+	}
+
+	Hierarchy *hierarchy = (Hierarchy *) calloc(1, sizeof(Hierarchy));
+	if (!hierarchy) {
+		return NULL;
+	}
+	hierarchy->inclusion = inclusion;
+	hierarchy->memLatency = memLatency;
+	for (i = 0; i < count; i++) {
+		Level *level = &hierarchy->levels[hierarchy->count++];
+		level->latency = levels[i].latency;
+		level->cache = cacheInit(levels[i].s, levels[i].E, levels[i].b);
+		level->policy = level->cache ? policyCreate(policyName, level->cache) : NULL;
+		if (!level->policy) {
+			hierarchyFree(hierarchy);
+			return NULL;
+		}
+	}
+	return hierarchy;
+}
+
+int hierarchyAccess(Hierarchy *hierarchy, unsigned long long addr, int isWrite) {
+	int served;
+	size_t set = 0;
+	int way = -1;
+
+	if (hierarchy->now >= POLICY_CLOCK_LIMIT) {
+		int i;
+		hierarchy->now = 0;
+		for (i = 0; i < hierarchy->count; i++) {
+			int top = policyRebase(hierarchy->levels[i].policy, hierarchy->levels[i].cache);
+			if (top > hierarchy->now) {
+				hierarchy->now = top;
+			}
+		}
+	}
+	hierarchy->now++;
+	hierarchy->accesses++;
+	for (served = 0; served < hierarchy->count; served++) {
+		Level *level = &hierarchy->levels[served];
+		way = lookup(level, addr, &set);
+		if (way >= 0) {
+			level->stats.hits++;
+			break;
+		}
+		level->stats.misses++;
+	}
+
+	if (served == 0) {
+		Level *l1 = &hierarchy->levels[0];
+		if (isWrite) {
+			cacheSetBit(l1->cache->dirty, l1->cache, set, way);
+		}
+		l1->policy->onHit(l1->policy, l1->cache, set, way, hierarchy->now);
+		return served;
+	}
+
+	int i;
+	if (served == hierarchy->count) {
+		hierarchy->memReads++;
+		i = hierarchy->inclusion == INCLUSION_EXCLUSIVE ? 0 : served - 1;
+	} else if (hierarchy->inclusion == INCLUSION_EXCLUSIVE) {
+		// move the block up, taking its dirty state with it
+		Level *level = &hierarchy->levels[served];
+		isWrite |= cacheTestBit(level->cache->dirty, level->cache, set, way);
+		invalidate(level, set, way);
+		i = 0;
+	} else {
+		Level *level = &hierarchy->levels[served];
+		level->policy->onHit(level->policy, level->cache, set, way, hierarchy->now);
+		i = served - 1;
+	}
+
+	// fill from the bottom up so back-invalidations land before upper fills
+	for (; i > 0; i--) {
+		fill(hierarchy, i, addr, 0);
+	}
+	fill(hierarchy, 0, addr, isWrite);
+	return served;
+}
+
+const LevelStats *hierarchyStats(const Hierarchy *hierarchy, int level) {
+	return &hierarchy->levels[level].stats;
+}
+
+double hierarchyAmat(const Hierarchy *hierarchy) {
+	double cycles = (double) hierarchy->memReads * hierarchy->memLatency;
+	int i;
+
+	if (!hierarchy->accesses) {
+		return 0;
+	}
+	for (i = 0; i < hierarchy->count; i++) {
+		const Level *level = &hierarchy->levels[i];
+		cycles += (double) level->stats.hits * level->latency;
+	}
+	return cycles / hierarchy->accesses;
+}
+
+void hierarchyReport(const Hierarchy *hierarchy, FILE *out) {
+	int i;
+	for (i = 0; i < hierarchy->count; i++) {
+		const LevelStats *stats = &hierarchy->levels[i].stats;
+		fprintf(out, "L%d hits:%llu misses:%llu evictions:%llu dirty_evictions:%llu "
+			"back_invalidations:%llu\n", i + 1, stats->hits, stats->misses,
+			stats->evictions, stats->dirtyEvictions, stats->backInvalidations);
+	}
+	fprintf(out, "mem reads:%llu writes:%llu\n", hierarchy->memReads, hierarchy->memWrites);
+	fprintf(out, "amat:%.2f\n", hierarchyAmat(hierarchy));
+}
+
+void hierarchyFree(Hierarchy *hierarchy) {
+	if (!hierarchy) {
+		return;
+	}
+	int i;
+	for (i = 0; i < hierarchy->count; i++) {
+		policyFree(hierarchy->levels[i].policy);
+		cacheFree(hierarchy->levels[i].cache);
+	}
+	free(hierarchy);
+}
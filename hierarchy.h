@@ -0,0 +1,91 @@
+/*
+ * hierarchy.h - Multi-level cache hierarchy (L1, L2, ..., LLC)
+ *
+ * Every access goes to L1; a miss moves on to the next level and so on
+ * to memory. How the levels share blocks is set by the inclusion
+ * policy:
+ *
+ *   inclusive  a miss fills every level above the one that hit, and a
+ *              block evicted from a lower level is back-invalidated
+ *              from all levels above it
+ *   exclusive  a block lives in one level only: misses fill L1 alone,
+ *              a lower-level hit moves the block up into L1 and each
+ *              level's victims drop into the level below
+ *   nine       (non-inclusive non-exclusive) fills like inclusive but
+ *              never back-invalidates
+ *
+ * Levels are write-back: dirty victims update the block in the nearest
+ * lower level holding it, or memory when none does. Block sizes may
+ * only grow going down (and must be equal for exclusive hierarchies),
+ * so an upper block always lies inside a single lower block.
+ */
+#ifndef HIERARCHY_H
+#define HIERARCHY_H
+
+#include <stdio.h>
+
+/* Most levels a hierarchy may have */
+#define MAX_LEVELS 4
+/* Names accepted by inclusionParse, for usage messages */
+#define INCLUSION_NAMES "inclusive, exclusive, nine"
+
+typedef enum Inclusion {
+	INCLUSION_INCLUSIVE,
+	INCLUSION_EXCLUSIVE,
+	INCLUSION_NINE
+} Inclusion;
+
+typedef struct LevelConfig {
+	int s;
+	int E;
+	int b;
+	int latency;    /* cycles for an access served by this level */
+} LevelConfig;
+
+typedef struct LevelStats {
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+	unsigned long long dirtyEvictions;
+	unsigned long long backInvalidations;
+} LevelStats;
+
+typedef struct Hierarchy Hierarchy;
+
+/* Parse "s:E:b:latency" into config. Returns 0 if spec is malformed */
+int levelParse(const char *spec, LevelConfig *config);
+
+/* Returns 0 for an unknown name */
+int inclusionParse(const char *name, Inclusion *inclusion);
+
+/*
+ * hierarchyCreate - Levels ordered from L1 down, each replaced with the
+ *                   named policy. memLatency is the cost of an access
+ *                   no level holds. Returns NULL for an invalid
+ *                   geometry or policy, or when out of memory.
+ */
+Hierarchy *hierarchyCreate(const LevelConfig *levels, int count,
+	Inclusion inclusion, const char *policyName, int memLatency);
+
+/*
+ * hierarchyAccess - Simulate one load or store. Returns the index of
+ *                   the level that served it, or the level count when
+ *                   it went to memory.
+ */
+int hierarchyAccess(Hierarchy *hierarchy, unsigned long long addr, int isWrite);
+
+const LevelStats *hierarchyStats(const Hierarchy *hierarchy, int level);
+
+/*
+ * hierarchyAmat - Average cycles per access: each access costs the
+ *                 latency of the level that served it. With a single
+ *                 level this is test-trans's hit/miss cycle model.
+ */
+double hierarchyAmat(const Hierarchy *hierarchy);
+
+/* Print one line of statistics per level, then memory traffic and AMAT */
+void hierarchyReport(const Hierarchy *hierarchy, FILE *out);
+
+void hierarchyFree(Hierarchy *hierarchy);
+
+#endif /* HIERARCHY_H */
@@ -0,0 +1,263 @@
+/*
+ * policy.c - Replacement policies for the simulated cache
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "policy.h"
+
+/* Largest re-reference prediction value of the 2-bit RRIP policies */
+#define RRPV_MAX 3
+/* BRRIP inserts with a long instead of distant prediction 1 time in 32 */
+#define BRRIP_LONG_ODDS 32
+
+static unsigned long long nextRandom(Policy *policy) {
+	// xorshift64: cheap and reproducible from run to run
+	unsigned long long x = policy->rng;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	policy->rng = x;
+	return x;
+}
+
+/* LRU: rank is the time of the last use */
+
+static void touchLru(Policy *policy, Cache *cache, size_t set, int way, int now) {
+	cacheRank(cache, set)[way] = now;
+}
+
+static int victimMinRank(Policy *policy, Cache *cache, size_t set) {
+	return cacheMinVictim(cache, set);
+}
+
+/* FIFO: rank is the time of the fill, hits leave it alone */
+
+static void ignoreHit(Policy *policy, Cache *cache, size_t set, int way, int now) {
+}
+
+/* LFU: rank counts uses since the fill */
+
+static void hitLfu(Policy *policy, Cache *cache, size_t set, int way, int now) {
+	int *rank = cacheRank(cache, set);
+	if (rank[way] < INT_MAX) {
+		rank[way]++;
+	}
+}
+
+static void fillLfu(Policy *policy, Cache *cache, size_t set, int way, int now) {
+	cacheRank(cache, set)[way] = 1;
+}
+
+/* Random */
+
+static void ignoreFill(Policy *policy, Cache *cache, size_t set, int way, int now) {
+}
+
+static int victimRandom(Policy *policy, Cache *cache, size_t set) {
+	return (int) (nextRandom(policy) % (unsigned long long) cache->E);
+}
+
+/*
+ * Tree-PLRU over the next power of two of E leaves. Node n has children
+ * 2n and 2n+1 and its bit says which child the next victim comes from;
+ * a use points every node on the way's path away from it.
+ */
+
+static void touchPlru(Policy *policy, Cache *cache, size_t set, int way, int now) {
+	unsigned long long *tree = policy->tree + set * policy->treeWords;
+	size_t node = 1;
+	int level;
+	for (level = policy->treeLevels - 1; level >= 0; level--) {
+		size_t dir = (way >> level) & 1;
+		if (dir) {
+			tree[node >> 6] &= ~(1ULL << (node & 63));
+		} else {
+			tree[node >> 6] |= 1ULL << (node & 63);
+		}
+		node = 2 * node + dir;
+	}
+}
+
+static int victimPlru(Policy *policy, Cache *cache, size_t set) {
+	const unsigned long long *tree = policy->tree + set * policy->treeWords;
+	size_t node = 1;
+	int way = 0;
+	int level;
+	for (level = policy->treeLevels - 1; level >= 0; level--) {
+		int dir = (tree[node >> 6] >> (node & 63)) & 1;
+		if ((way | (dir << level)) >= cache->E) {
+			dir = 0; // right subtree holds only padding leaves
+		}
+		way |= dir << level;
+		node = 2 * node + dir;
+	}
+	return way;
+}
+
+/* SRRIP / BRRIP */
+
+static void hitRrip(Policy *policy, Cache *cache, size_t set, int way, int now) {
+	policy->rrpv[set * cache->E + way] = 0;
+}
+
+static void fillSrrip(Policy *policy, Cache *cache, size_t set, int way, int now) {
+	policy->rrpv[set * cache->E + way] = RRPV_MAX - 1;
+}
+
+static void fillBrrip(Policy *policy, Cache *cache, size_t set, int way, int now) {
+	int longInsert = nextRandom(policy) % BRRIP_LONG_ODDS == 0;
+	policy->rrpv[set * cache->E + way] = longInsert ? RRPV_MAX - 1 : RRPV_MAX;
+}
+
+static int victimRrip(Policy *policy, Cache *cache, size_t set) {
+	unsigned char *rrpv = policy->rrpv + set * cache->E;
+	unsigned char oldest = 0;
+	int way;
+	for (way = 0; way < cache->E; way++) {
+		if (rrpv[way] > oldest) {
+			oldest = rrpv[way];
+		}
+	}
+	// age the whole set in one step until some way is distant
+	unsigned char age = RRPV_MAX - oldest;
+	int victim = -1;
+	for (way = 0; way < cache->E; way++) {
+		rrpv[way] += age;
+		if (victim < 0 && rrpv[way] == RRPV_MAX) {
+			victim = way;
+		}
+	}
+	return victim;
+}
+
+Policy *policyCreate(const char *name, const Cache *cache) {
+	Policy *policy = (Policy *) calloc(1, sizeof(Policy));
+	if (!policy) {
+		return NULL;
+	}
+	policy->rng = 0x9e3779b97f4a7c15ULL;
+	policy->victim = victimMinRank;
+
+	if (strcmp(name, "lru") == 0) {
+		policy->name = "lru";
+		policy->onHit = touchLru;
+		policy->onFill = touchLru;
+		policy->timeRanks = 1;
+	} else if (strcmp(name, "fifo") == 0) {
+		policy->name = "fifo";
+		policy->onHit = ignoreHit;
+		policy->onFill = touchLru;
+		policy->timeRanks = 1;
+	} else if (strcmp(name, "lfu") == 0) {
+		policy->name = "lfu";
+		policy->onHit = hitLfu;
+		policy->onFill = fillLfu;
+	} else if (strcmp(name, "random") == 0) {
+		policy->name = "random";
+		policy->onHit = ignoreHit;
+		policy->onFill = ignoreFill;
+		policy->victim = victimRandom;
+	} else if (strcmp(name, "plru") == 0) {
+		policy->name = "plru";
+		while ((1 << policy->treeLevels) < cache->E) {
+			policy->treeLevels++;
+		}
+		policy->treeWords = (((size_t) 1 << policy->treeLevels) + 63) / 64;
+		policy->tree = (unsigned long long *) calloc(cache->sets * policy->treeWords,
+			sizeof(unsigned long long));
+		policy->onHit = touchPlru;
+		policy->onFill = touchPlru;
+		policy->victim = victimPlru;
+		if (!policy->tree) {
+			policyFree(policy);
+			return NULL;
+		}
+	} else if (strcmp(name, "srrip") == 0 || strcmp(name, "brrip") == 0) {
+		int bimodal = strcmp(name, "brrip") == 0;
+		policy->name = bimodal ? "brrip" : "srrip";
+		policy->rrpv = (unsigned char *) calloc(cache->sets * cache->E, 1);
+		policy->onHit = hitRrip;
+		policy->onFill = bimodal ? fillBrrip : fillSrrip;
+		policy->victim = victimRrip;
+		if (!policy->rrpv) {
+			policyFree(policy);
+			return NULL;
+		}
+	} else {
+		policyFree(policy);
+		return NULL;
+	}
+	if (policy->timeRanks) {
+		policy->rebaseScratch = (int *) malloc(2 * cache->E * sizeof(int));
+		if (!policy->rebaseScratch) {
+			policyFree(policy);
+			return NULL;
+		}
+	}
+	return policy;
+}
+
+Policy *policyFork(const Policy *policy, unsigned long long seed) {
+	Policy *fork = (Policy *) malloc(sizeof(Policy));
+	if (!fork) {
+		return NULL;
+	}
+	*fork = *policy;
+	fork->rng ^= seed * 0x9e3779b97f4a7c15ULL;
+	if (!fork->rng) {
+		fork->rng = 1;
+	}
+	fork->sharesState = 1;
+	return fork;
+}
+
+/* Order pairs of (rank, way) by rank, then way */
+static int compareRanked(const void *a, const void *b) {
+	const int *x = (const int *) a;
+	const int *y = (const int *) b;
+	if (x[0] != y[0]) {
+		return x[0] < y[0] ? -1 : 1;
+	}
+	return x[1] - y[1];
+}
+
+int policyRebase(Policy *policy, Cache *cache) {
+	int *pairs = policy->rebaseScratch;
+	size_t set;
+	int way;
+
+	if (!policy->timeRanks) {
+		return 0;
+	}
+	for (set = 0; set < cache->sets; set++) {
+		int *rank = cacheRank(cache, set);
+		for (way = 0; way < cache->E; way++) {
+			pairs[2 * way] = rank[way];
+			pairs[2 * way + 1] = way;
+		}
+		qsort(pairs, cache->E, 2 * sizeof(int), compareRanked);
+		int next = 0;
+		for (way = 0; way < cache->E; way++) {
+			if (way == 0 || pairs[2 * way] != pairs[2 * way - 2]) {
+				next++;
+			}
+			rank[pairs[2 * way + 1]] = next;
+		}
+	}
+	return cache->E;
+}
+
+void policyFree(Policy *policy) {
+	if (!policy) {
+		return;
+	}
+	if (!policy->sharesState) {
+		free(policy->rrpv);
+		free(policy->tree);
+		free(policy->rebaseScratch);
+	}
+	free(policy);
+}
+
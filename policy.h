@@ -0,0 +1,69 @@
+/*
+ * policy.h - Replacement policies for the simulated cache
+ *
+ * A policy is told about every hit and fill and picks the victim when
+ * a full set misses. State is kept per set in compact form: LRU, FIFO
+ * and LFU reuse the cache's per-way rank, tree-PLRU keeps E-1 bits per
+ * set and SRRIP/BRRIP a 2-bit re-reference prediction per way (held in
+ * a byte).
+ *
+ * The now passed to onHit and onFill is a 32-bit policy clock, not the
+ * trace position. Before it reaches POLICY_CLOCK_LIMIT the caller calls
+ * policyRebase, which renumbers time-valued ranks per set while keeping
+ * their order, and restarts the clock above them; so ranks stay 32-bit
+ * (and the victim kernels keep their lanes) however long the trace.
+ */
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <stddef.h>
+#include <limits.h>
+
+#include "cache.h"
+
+/* Policy clock value that calls for a policyRebase; -D a smaller one to test */
+#ifndef POLICY_CLOCK_LIMIT
+#define POLICY_CLOCK_LIMIT (INT_MAX - 1)
+#endif
+
+/* Names accepted by policyCreate, for usage messages */
+#define POLICY_NAMES "lru, fifo, random, plru, srrip, brrip, lfu"
+
+typedef struct Policy Policy;
+
+struct Policy {
+	const char *name;
+	void (*onHit)(Policy *policy, Cache *cache, size_t set, int way, int now);
+	void (*onFill)(Policy *policy, Cache *cache, size_t set, int way, int now);
+	int (*victim)(Policy *policy, Cache *cache, size_t set);
+	unsigned char *rrpv;        /* SRRIP/BRRIP: E per set */
+	unsigned long long *tree;   /* PLRU: treeWords per set, bit n is node n */
+	size_t treeWords;
+	int treeLevels;
+	unsigned long long rng;     /* random victims, BRRIP insertion */
+	int sharesState;            /* state arrays belong to another policy */
+	int timeRanks;              /* LRU, FIFO: ranks are policy clock values */
+	int *rebaseScratch;         /* LRU, FIFO: (rank, way) pairs for a set */
+};
+
+/* Returns NULL for an unknown name or when out of memory */
+Policy *policyCreate(const char *name, const Cache *cache);
+
+/*
+ * policyFork - A policy sharing the per-set state of policy but with its
+ *              own random stream, for a thread that owns a disjoint
+ *              range of sets. Free forks before the original.
+ */
+Policy *policyFork(const Policy *policy, unsigned long long seed);
+
+/*
+ * policyRebase - Renumber time-valued ranks of every set of cache to
+ *                1, 2, ... in their existing order (equal ranks stay
+ *                equal). Returns the clock value to continue from: no
+ *                rank is above it. No thread may use cache meanwhile.
+ */
+int policyRebase(Policy *policy, Cache *cache);
+
+void policyFree(Policy *policy);
+
+#endif /* POLICY_H */
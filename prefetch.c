@@ -0,0 +1,259 @@
+/*
+ * prefetch.c - Hardware prefetcher models
+ *
+ * The stride table is direct mapped by page and each stream buffer is
+ * a circular FIFO of block numbers, all sized from the spec when the
+ * prefetcher is created.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "prefetch.h"
+
+/* Region the stride detector trains on: a 4KB page */
+#define PAGE_BITS 12
+/* Most fields after the name of a spec */
+#define MAX_FIELDS 2
+/* Most stride table entries, stream buffers and stream depth accepted */
+#define MAX_TABLE 65536
+#define MAX_STREAMS 64
+#define MAX_DEPTH 1024
+
+typedef enum PrefetchKind {
+	PREFETCH_NEXTLINE,
+	PREFETCH_STRIDE,
+	PREFETCH_STREAM
+} PrefetchKind;
+
+typedef struct StrideEntry {
+	unsigned long long page;    /* page number + 1, 0 marks an empty entry */
+	unsigned long long last;    /* block of the latest access in the page */
+	long long stride;           /* in blocks */
+	int confirmed;              /* stride seen twice in a row */
+} StrideEntry;
+
+typedef struct StreamSlot {
+	unsigned long long block;
+	unsigned long long issuedAt;
+} StreamSlot;
+
+typedef struct Stream {
+	StreamSlot *slots;          /* depth of them, a FIFO from head */
+	int head;
+	int count;
+	unsigned long long next;    /* block the next fetch brings in */
+	unsigned long long lastUse; /* for picking the buffer to restart */
+} Stream;
+
+struct Prefetcher {
+	PrefetchKind kind;
+	int b;
+	int degree;
+	StrideEntry *table;
+	int tableSize;
+	Stream *streams;
+	StreamSlot *slots;          /* every stream's, streamCount * depth */
+	int streamCount;
+	int depth;
+	unsigned long long uses;
+};
+
+/*
+ * parseFields - Parse up to MAX_FIELDS ":n" fields following a name
+ *               into fields, which keep their defaults when absent.
+ *               Returns 0 if spec is malformed.
+ */
+static int parseFields(const char *spec, int *fields, int count) {
+	int i;
+	for (i = 0; i < count && *spec == ':'; i++) {
+		char *end;
+		long value = strtol(spec + 1, &end, 10);
+		if (end == spec + 1 || value <= 0 || value > MAX_TABLE) {
+			return 0;
+		}
+		fields[i] = (int) value;
+		spec = end;
+	}
+	return *spec == '\0';
+}
+
+/* Whether spec is name, alone or followed by ':' fields */
+static int isKind(const char *spec, const char *name) {
+	size_t length = strlen(name);
+	return strncmp(spec, name, length) == 0 &&
+		(spec[length] == '\0' || spec[length] == ':');
+}
+
+Prefetcher *prefetcherCreate(const char *spec, int b) {
+	int fields[MAX_FIELDS];
+	PrefetchKind kind;
+
+	if (isKind(spec, "nextline")) {
+		kind = PREFETCH_NEXTLINE;
+		fields[0] = 1;
+		spec += strlen("nextline");
+	} else if (isKind(spec, "stride")) {
+		kind = PREFETCH_STRIDE;
+		fields[0] = 1;
+		fields[1] = 64;
+		spec += strlen("stride");
+	} else if (isKind(spec, "stream")) {
+		kind = PREFETCH_STREAM;
+		fields[0] = 4;
+		fields[1] = 4;
+		spec += strlen("stream");
+	} else {
+		return NULL;
+	}
+	if (!parseFields(spec, fields, kind == PREFETCH_NEXTLINE ? 1 : 2)) {
+		return NULL;
+	}
+	if (kind != PREFETCH_STREAM && fields[0] > PREFETCH_MAX) {
+		return NULL;
+	}
+	if (kind == PREFETCH_STREAM && (fields[0] > MAX_STREAMS || fields[1] > MAX_DEPTH)) {
+		return NULL;
+	}
+
+	Prefetcher *prefetcher = (Prefetcher *) calloc(1, sizeof(Prefetcher));
+	if (!prefetcher) {
+		return NULL;
+	}
+	prefetcher->kind = kind;
+	prefetcher->b = b;
+	if (kind == PREFETCH_STRIDE) {
+		prefetcher->degree = fields[0];
+		prefetcher->tableSize = fields[1];
+		prefetcher->table = (StrideEntry *) calloc(fields[1], sizeof(StrideEntry));
+		if (!prefetcher->table) {
+			prefetcherFree(prefetcher);
+			return NULL;
+		}
+	} else if (kind == PREFETCH_STREAM) {
+		int k;
+		prefetcher->streamCount = fields[0];
+		prefetcher->depth = fields[1];
+		prefetcher->streams = (Stream *) calloc(fields[0], sizeof(Stream));
+		prefetcher->slots = (StreamSlot *) calloc((size_t) fields[0] * fields[1],
+			sizeof(StreamSlot));
+		if (!prefetcher->streams || !prefetcher->slots) {
+			prefetcherFree(prefetcher);
+			return NULL;
+		}
+		for (k = 0; k < fields[0]; k++) {
+			prefetcher->streams[k].slots = prefetcher->slots + (size_t) k * fields[1];
+		}
+	} else {
+		prefetcher->degree = fields[0];
+	}
+	return prefetcher;
+}
+
+/* Block numbers block + stride * 1..degree into blocks */
+static int along(unsigned long long block, long long stride, int degree,
+	unsigned long long *blocks) {
+	int i;
+	for (i = 0; i < degree; i++) {
+		blocks[i] = block + (unsigned long long) (stride * (i + 1));
+	}
+	return degree;
+}
+
+int prefetcherAccess(Prefetcher *prefetcher, unsigned long long addr,
+	PrefetchTrigger trigger, unsigned long long *blocks) {
+	unsigned long long block = addr >> prefetcher->b;
+
+	switch (prefetcher->kind) {
+		case PREFETCH_NEXTLINE:
+		if (trigger == PREFETCH_HIT) {
+			return 0;
+		}
+		return along(block, 1, prefetcher->degree, blocks);
+		case PREFETCH_STRIDE: {
+		unsigned long long page = addr >> PAGE_BITS;
+		StrideEntry *entry = &prefetcher->table[page % prefetcher->tableSize];
+		if (entry->page != page + 1) {
+			entry->page = page + 1;
+			entry->last = block;
+			entry->stride = 0;
+			entry->confirmed = 0;
+			return 0;
+		}
+		long long stride = (long long) (block - entry->last);
+		if (stride == 0) {
+			return 0;
+		}
+		entry->confirmed = stride == entry->stride;
+		entry->stride = stride;
+		entry->last = block;
+		return entry->confirmed ? along(block, stride, prefetcher->degree, blocks) : 0;
+		}
+		case PREFETCH_STREAM:
+		break;
+	}
+	return 0;
+}
+
+/* fetch - Top stream up to full depth with the blocks following it */
+static void fetch(Prefetcher *prefetcher, Stream *stream, unsigned long long now,
+	PrefetchStats *stats) {
+	while (stream->count < prefetcher->depth) {
+		StreamSlot *slot = &stream->slots[(stream->head + stream->count) % prefetcher->depth];
+		slot->block = stream->next++;
+		slot->issuedAt = now;
+		stream->count++;
+		++(stats->issued);
+	}
+}
+
+int prefetcherLookup(Prefetcher *prefetcher, unsigned long long addr,
+	unsigned long long now, unsigned long long *issuedAt, PrefetchStats *stats) {
+	unsigned long long block = addr >> prefetcher->b;
+	Stream *oldest = &prefetcher->streams[0];
+	int k;
+	int i;
+
+	prefetcher->uses++;
+	for (k = 0; k < prefetcher->streamCount; k++) {
+		Stream *stream = &prefetcher->streams[k];
+		for (i = 0; i < stream->count; i++) {
+			const StreamSlot *slot = &stream->slots[(stream->head + i) % prefetcher->depth];
+			if (slot->block != block) {
+				continue;
+			}
+			// the blocks ahead of it in the FIFO were skipped over
+			*issuedAt = slot->issuedAt;
+			stats->polluting += i;
+			stream->head = (stream->head + i + 1) % prefetcher->depth;
+			stream->count -= i + 1;
+			stream->lastUse = prefetcher->uses;
+			fetch(prefetcher, stream, now, stats);
+			return 1;
+		}
+		if (stream->lastUse < oldest->lastUse) {
+			oldest = stream;
+		}
+	}
+
+	stats->polluting += oldest->count;
+	oldest->head = 0;
+	oldest->count = 0;
+	oldest->next = block + 1;
+	oldest->lastUse = prefetcher->uses;
+	fetch(prefetcher, oldest, now, stats);
+	return 0;
+}
+
+int prefetcherHasBuffers(const Prefetcher *prefetcher) {
+	return prefetcher->kind == PREFETCH_STREAM;
+}
+
+void prefetcherFree(Prefetcher *prefetcher) {
+	if (!prefetcher) {
+		return;
+	}
+	free(prefetcher->table);
+	free(prefetcher->streams);
+	free(prefetcher->slots);
+	free(prefetcher);
+}
@@ -0,0 +1,73 @@
+/*
+ * prefetch.h - Hardware prefetcher models
+ *
+ * A prefetcher watches the demand accesses and names blocks to bring
+ * into the cache ahead of use. The simulator installs them like any
+ * fill, marking the line as prefetched until a demand access uses it.
+ *
+ *   nextline:N         on a miss, or the first use of a prefetched
+ *                      line, fetch the next N blocks
+ *   stride:N:T         per-region (4KB page) stride detector with T
+ *                      table entries, no instruction pointers; after
+ *                      the same stride twice in a row it fetches the
+ *                      next N blocks along it
+ *   stream:K:D         K stream buffers of depth D beside the cache;
+ *                      a miss found in a buffer moves the block into
+ *                      the cache (and counts as a hit), a miss found
+ *                      nowhere restarts the least recently used
+ *                      buffer at the following D blocks
+ *
+ * All state is allocated by prefetcherCreate: an access only touches
+ * fixed tables.
+ */
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+/* Most blocks a single access may ask for */
+#define PREFETCH_MAX 16
+/* Prefetcher specs accepted by prefetcherCreate, for usage messages */
+#define PREFETCH_NAMES "nextline:N, stride:N:T, stream:K:D"
+
+typedef struct PrefetchStats {
+	unsigned long long issued;      /* blocks fetched by the prefetcher */
+	unsigned long long useful;      /* of those, used by a demand access */
+	unsigned long long late;        /* used too soon after issue to have arrived */
+	unsigned long long polluting;   /* evicted or dropped before any use */
+} PrefetchStats;
+
+/* What the demand access that prefetcherAccess is told about did */
+typedef enum PrefetchTrigger {
+	PREFETCH_HIT,
+	PREFETCH_MISS,
+	PREFETCH_FIRST_USE      /* hit on a prefetched line not used before */
+} PrefetchTrigger;
+
+typedef struct Prefetcher Prefetcher;
+
+/* Parse spec and build the prefetcher for blocks of 2^b bytes. NULL if malformed */
+Prefetcher *prefetcherCreate(const char *spec, int b);
+
+/*
+ * prefetcherAccess - Train on a demand access to addr and write the
+ *                    block numbers to prefetch into blocks (at most
+ *                    PREFETCH_MAX). Returns how many.
+ */
+int prefetcherAccess(Prefetcher *prefetcher, unsigned long long addr,
+	PrefetchTrigger trigger, unsigned long long *blocks);
+
+/*
+ * prefetcherLookup - For stream buffers: on a demand miss to addr at
+ *                    time now, take the block from a buffer holding it
+ *                    (returning 1 and its issue time in *issuedAt) or
+ *                    restart a buffer after it (returning 0). Counts
+ *                    issued and dropped blocks in stats.
+ */
+int prefetcherLookup(Prefetcher *prefetcher, unsigned long long addr,
+	unsigned long long now, unsigned long long *issuedAt, PrefetchStats *stats);
+
+/* Whether misses must go through prefetcherLookup first */
+int prefetcherHasBuffers(const Prefetcher *prefetcher);
+
+void prefetcherFree(Prefetcher *prefetcher);
+
+#endif /* PREFETCH_H */
@@ -0,0 +1,121 @@
+/*
+ * ring.h - Single-producer single-consumer ring of trace records
+ *
+ * The producer fills slots past its private tail and publishes them in
+ * bulk with ringPublish; the consumer drains everything published and
+ * hands the slots back with ringRelease. Head and tail live on their
+ * own host cache lines so the two threads only share a line when one
+ * of them publishes.
+ *
+ * A waiting side yields a while and then sleeps in short naps, so an
+ * idle ring costs little CPU. Includers need nanosleep (POSIX).
+ */
+#ifndef RING_H
+#define RING_H
+
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+
+/* Slots per ring, a power of two */
+#define RING_SIZE (1 << 16)
+/* Yields before a waiting side starts to nap, and the nap length */
+#define RING_SPINS 64
+#define RING_NAP_NS 50000
+
+typedef struct RingEntry {
+	unsigned long long addr;
+	int seq;
+	char op;
+	char tag;               /* one byte the producer passes along */
+} RingEntry;
+
+typedef struct Ring {
+	RingEntry *slots;
+	size_t head __attribute__((aligned(64)));   /* next slot to consume */
+	size_t tail __attribute__((aligned(64)));   /* slots published so far */
+	int done;                                   /* producer has finished */
+	size_t localTail __attribute__((aligned(64))); /* producer only */
+	size_t cachedHead;                             /* producer only */
+} Ring;
+
+static inline void ringBackoff(int *spins) {
+	if (++*spins < RING_SPINS) {
+		sched_yield();
+	} else {
+		struct timespec nap = {0, RING_NAP_NS};
+		nanosleep(&nap, NULL);
+	}
+}
+
+static inline int ringInit(Ring *ring) {
+	ring->slots = (RingEntry *) malloc(RING_SIZE * sizeof(RingEntry));
+	ring->head = ring->tail = ring->localTail = ring->cachedHead = 0;
+	ring->done = 0;
+	return ring->slots != NULL;
+}
+
+static inline void ringPublish(Ring *ring) {
+	__atomic_store_n(&ring->tail, ring->localTail, __ATOMIC_RELEASE);
+}
+
+/* Producer: append one entry, publishing and waiting while the ring is full */
+static inline void ringPush(Ring *ring, unsigned long long addr, int seq, char op,
+	char tag) {
+	if (ring->localTail - ring->cachedHead == RING_SIZE) {
+		int spins = 0;
+		ringPublish(ring);
+		while ((ring->cachedHead = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+			== ring->localTail - RING_SIZE) {
+			ringBackoff(&spins);
+		}
+	}
+	RingEntry *entry = &ring->slots[ring->localTail & (RING_SIZE - 1)];
+	entry->addr = addr;
+	entry->seq = seq;
+	entry->op = op;
+	entry->tag = tag;
+	ring->localTail++;
+}
+
+static inline void ringFinish(Ring *ring) {
+	ringPublish(ring);
+	__atomic_store_n(&ring->done, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * ringWait - Consumer: number of published entries from head on,
+ *            waiting for some. Returns 0 once the producer is done and
+ *            everything has been consumed.
+ */
+static inline size_t ringWait(Ring *ring) {
+	int spins = 0;
+	for (;;) {
+		int done = __atomic_load_n(&ring->done, __ATOMIC_ACQUIRE);
+		size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		if (tail != ring->head || done) {
+			return tail - ring->head;
+		}
+		ringBackoff(&spins);
+	}
+}
+
+static inline void ringRelease(Ring *ring, size_t count) {
+	__atomic_store_n(&ring->head, ring->head + count, __ATOMIC_RELEASE);
+}
+
+/* Producer: publish and wait until the consumer has released everything */
+static inline void ringDrain(Ring *ring) {
+	int spins = 0;
+	ringPublish(ring);
+	while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != ring->localTail) {
+		ringBackoff(&spins);
+	}
+	ring->cachedHead = ring->localTail;
+}
+
+static inline void ringFree(Ring *ring) {
+	free(ring->slots);
+}
+
+#endif /* RING_H */
@@ -0,0 +1,1227 @@
+/*
+ * sim.c - Reentrant cache simulator library (libcsim)
+ *
+ * With threads, the calling thread only routes each access to the
+ * worker owning its set over a ring (ring.h); each worker owns a
+ * contiguous range of sets and a fork of the policy. Sets never
+ * interact, so the summed counts equal a serial run (except under
+ * policies drawing random numbers, as each worker has its own stream).
+ * Observed accesses are logged with their sequence number and merged
+ * back into trace order by the routing thread every SIM_LOG_LIMIT
+ * accesses, which bounds each worker's log.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "sim.h"
+#include "cache.h"
+#include "policy.h"
+#include "ring.h"
+#include "classify.h"
+#include "prefetch.h"
+#include "buffers.h"
+#include "tlb.h"
+
+/* Standard normal quantile of a two-sided 95% confidence interval */
+#define SIM_Z95 1.96
+/* Accesses between replays of the workers' observer logs, and each log's size */
+#define SIM_LOG_LIMIT (1 << 16)
+
+typedef struct Counts {
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+	unsigned long long dirtied;         /* lines made dirty */
+	unsigned long long dirtyEvicted;    /* of those, evicted again */
+	unsigned long long classes[MISS_CLASSES];   /* misses by cause */
+	PrefetchStats prefetch;
+	unsigned long long victimHits;      /* misses served by the victim cache */
+	unsigned long long memReads;        /* blocks read from memory */
+	unsigned long long memWriteBytes;
+} Counts;
+
+/* Counters of one set, with per-set statistics on */
+typedef struct SetCounts {
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+	unsigned long long classes[MISS_CLASSES];
+} SetCounts;
+
+/* An access recorded by a worker for in-order observer calls */
+typedef struct LoggedAccess {
+	unsigned long long addr;
+	int seq;
+	char op;
+	char outcome;
+} LoggedAccess;
+
+/* A thread simulating a disjoint range of sets */
+typedef struct Worker {
+	pthread_t thread;
+	Ring ring;
+	Sim *sim;
+	Policy *policy;
+	Counts counts;
+	Counts *regionCounts;   /* the worker's own, sets do not split regions */
+	LoggedAccess *log;      /* SIM_LOG_LIMIT entries, with an observer */
+	size_t logCount;
+	size_t logNext;         /* next entry replayLogs passes on */
+} Worker;
+
+struct Sim {
+	Cache *cache;
+	Policy *policy;
+	int split;
+	unsigned long long splitEnd;    /* one past the record being split */
+	unsigned long long now;         /* trace records (or split probes) so far */
+	unsigned long long clockBase;   /* now at policy clock 0, see policy.h */
+	unsigned long long nextEvent;   /* now of the next snapshot, log replay or rebase */
+	unsigned long long nextReplay;  /* now of the next replay of the workers' logs */
+	SimObserver observer;
+	void *observerCtx;
+	Counts counts;
+	Worker *workers;
+	int workerCount;
+	Classifier *classifier;
+	SetCounts *setCounts;   /* per set, or NULL */
+	SimRegion *regions;
+	int regionCount;
+	Counts *regionCounts;
+	int interval;           /* accesses per snapshot, 0 for none */
+	unsigned long long nextSnapshot;    /* value of now that triggers it */
+	Counts snapshotCounts;  /* totals at the previous snapshot */
+	SimSnapshot snapshot;
+	void *snapshotCtx;
+	size_t sampleMask;      /* set bits that must be clear to simulate */
+	Prefetcher *prefetcher;
+	unsigned long long *prefetchedAt;   /* per way: now when a prefetch filled
+	                                       it, 0 once used or for demand fills */
+	int prefetchLatency;
+	int writeThrough;
+	int noWriteAllocate;
+	VictimCache *victims;
+	WriteBuffer *combiner;
+	Tlb *tlb;
+	void (*kernel)(Sim *sim, const TraceRecord *recs, size_t count);
+	const char *kernelName;
+};
+
+static int getSet(const Cache *cache, unsigned long long addr) {
+	if (cache->s == 0) {
+		return 0;
+	}
+	return ((1 << cache->s) - 1) & (addr >> cache->b);
+}
+
+static unsigned long long getTag(const Cache *cache, unsigned long long addr) {
+	unsigned long long shift = cache->b + cache->s;
+	return ((1LL << (63LL - shift)) - 1LL) & (addr >> shift);
+}
+
+static void countsAdd(Counts *total, const Counts *counts) {
+	int c;
+	total->hits += counts->hits;
+	total->misses += counts->misses;
+	total->evictions += counts->evictions;
+	total->dirtied += counts->dirtied;
+	total->dirtyEvicted += counts->dirtyEvicted;
+	for (c = 0; c < MISS_CLASSES; c++) {
+		total->classes[c] += counts->classes[c];
+	}
+	total->prefetch.issued += counts->prefetch.issued;
+	total->prefetch.useful += counts->prefetch.useful;
+	total->prefetch.late += counts->prefetch.late;
+	total->prefetch.polluting += counts->prefetch.polluting;
+	total->victimHits += counts->victimHits;
+	total->memReads += counts->memReads;
+	total->memWriteBytes += counts->memWriteBytes;
+}
+
+static void countsSub(Counts *total, const Counts *counts) {
+	int c;
+	total->hits -= counts->hits;
+	total->misses -= counts->misses;
+	total->evictions -= counts->evictions;
+	total->dirtied -= counts->dirtied;
+	total->dirtyEvicted -= counts->dirtyEvicted;
+	for (c = 0; c < MISS_CLASSES; c++) {
+		total->classes[c] -= counts->classes[c];
+	}
+	total->prefetch.issued -= counts->prefetch.issued;
+	total->prefetch.useful -= counts->prefetch.useful;
+	total->prefetch.late -= counts->prefetch.late;
+	total->prefetch.polluting -= counts->prefetch.polluting;
+	total->victimHits -= counts->victimHits;
+	total->memReads -= counts->memReads;
+	total->memWriteBytes -= counts->memWriteBytes;
+}
+
+/* Index of the first region holding addr, or -1 */
+static int findRegion(const Sim *sim, unsigned long long addr) {
+	int r;
+	for (r = 0; r < sim->regionCount; r++) {
+		if (addr >= sim->regions[r].start && addr < sim->regions[r].end) {
+			return r;
+		}
+	}
+	return -1;
+}
+
+/*
+ * tally - Count an outcome against addr's set and region, where the
+ *         sim keeps those, and a miss against its class cls.
+ */
+static void tally(const Sim *sim, Counts *counts, Counts *regionCounts,
+	int setIndex, unsigned long long addr, SimOutcome outcome, MissClass cls) {
+	if (outcome != SIM_HIT && cls < MISS_CLASSES) {
+		++(counts->classes[cls]);
+	}
+	if (sim->setCounts) {
+		SetCounts *set = &sim->setCounts[setIndex];
+		if (outcome == SIM_HIT) {
+			++(set->hits);
+		} else {
+			++(set->misses);
+			set->evictions += outcome == SIM_EVICTION;
+			if (cls < MISS_CLASSES) {
+				++(set->classes[cls]);
+			}
+		}
+	}
+	if (regionCounts) {
+		int region = findRegion(sim, addr);
+		if (region >= 0) {
+			Counts *regionCount = &regionCounts[region];
+			if (outcome == SIM_HIT) {
+				++(regionCount->hits);
+			} else {
+				++(regionCount->misses);
+				regionCount->evictions += outcome == SIM_EVICTION;
+				if (cls < MISS_CLASSES) {
+					++(regionCount->classes[cls]);
+				}
+			}
+		}
+	}
+}
+
+/* Block of the line in way of set */
+static unsigned long long lineBlock(const Cache *cache, int setIndex, int way) {
+	return (cacheTags(cache, setIndex)[way] << cache->s) | (unsigned long long) setIndex;
+}
+
+/* writeMemory - Send a store of size bytes at addr (within its block) to memory */
+static void writeMemory(const Sim *sim, Counts *counts, unsigned long long addr, int size) {
+	if (sim->combiner) {
+		counts->memWriteBytes += writeBufferStore(sim->combiner, addr, size);
+		return;
+	}
+	unsigned long long room = (1ULL << sim->cache->b) - (addr & ((1ULL << sim->cache->b) - 1));
+	counts->memWriteBytes += size < 1 ? 1 : (unsigned long long) size < room ?
+		(unsigned long long) size : room;
+}
+
+/* retire - Hand an evicted block to the victim cache, or write it back if dirty */
+static void retire(const Sim *sim, Counts *counts, unsigned long long block, int dirty) {
+	if (sim->victims && !victimPut(sim->victims, block, dirty, &block, &dirty)) {
+		return;
+	}
+	if (dirty) {
+		counts->memWriteBytes += 1ULL << sim->cache->b;
+	}
+}
+
+/*
+ * accessCache - Look addr up and let the replacement policy pick the
+ *               victim on a miss to a full set. By default writes are
+ *               write-back and write-allocate: a miss fills the line and
+ *               any write leaves it dirty. Write-through stores go to
+ *               memory as well and never dirty a line; no-write-allocate
+ *               store misses go to memory alone. A miss takes its block
+ *               back from the victim cache when it is there. now orders
+ *               accesses for the policy, a miss belongs to class cls and
+ *               a store writes size bytes. policy and the counters are
+ *               those of the calling thread.
+ */
+static SimOutcome accessCache(const Sim *sim, unsigned long long addr, int size,
+	int isWrite, int now, MissClass cls, Policy *policy, Counts *counts,
+	Counts *regionCounts) {
+	Cache *cache = sim->cache;
+	int setIndex = getSet(cache, addr);
+	unsigned long long tag = getTag(cache, addr);
+
+	// check for hit
+	int way = cacheFindWay(cache, setIndex, tag);
+	if (way >= 0) {
+		if (isWrite && sim->writeThrough) {
+			writeMemory(sim, counts, addr, size);
+		} else if (isWrite && !cacheTestBit(cache->dirty, cache, setIndex, way)) {
+			++(counts->dirtied);
+			cacheSetBit(cache->dirty, cache, setIndex, way);
+		}
+		policy->onHit(policy, cache, setIndex, way, now);
+		++(counts->hits);
+		tally(sim, counts, regionCounts, setIndex, addr, SIM_HIT, cls);
+		return SIM_HIT;
+	}
+
+	// the line filled is dirty after a write-back store or a dirty victim
+	int dirty = isWrite && !sim->writeThrough;
+	int victimDirty;
+	if (sim->victims && victimTake(sim->victims, addr >> cache->b, &victimDirty)) {
+		++(counts->victimHits);
+		dirty |= victimDirty;
+	} else if (isWrite && sim->noWriteAllocate) {
+		writeMemory(sim, counts, addr, size);
+		++(counts->misses);
+		tally(sim, counts, regionCounts, setIndex, addr, SIM_MISS, cls);
+		return SIM_MISS;
+	} else {
+		++(counts->memReads);
+	}
+	if (isWrite && sim->writeThrough) {
+		writeMemory(sim, counts, addr, size);
+	}
+
+	// cold miss into an empty line, or conflict miss evicting one
+	SimOutcome outcome = SIM_MISS;
+	way = cacheFindInvalid(cache, setIndex);
+	if (way >= 0) {
+		cacheSetBit(cache->valid, cache, setIndex, way);
+	} else {
+		way = policy->victim(policy, cache, setIndex);
+		int evictedDirty = cacheTestBit(cache->dirty, cache, setIndex, way);
+		counts->dirtyEvicted += evictedDirty;
+		++(counts->evictions);
+		retire(sim, counts, lineBlock(cache, setIndex, way), evictedDirty);
+		outcome = SIM_EVICTION;
+	}
+
+	cacheTags(cache, setIndex)[way] = tag;
+	if (dirty) {
+		cacheSetBit(cache->dirty, cache, setIndex, way);
+		++(counts->dirtied);
+	} else {
+		cacheClearBit(cache->dirty, cache, setIndex, way);
+	}
+	policy->onFill(policy, cache, setIndex, way, now);
+	++(counts->misses);
+	tally(sim, counts, regionCounts, setIndex, addr, outcome, cls);
+	return outcome;
+}
+
+/*
+ * prefetchFill - Install block as a prefetched line, evicting if the
+ *                set is full. It comes from the victim cache, dirty
+ *                state and all, when there. Returns its slot in
+ *                prefetchedAt, or -1 when the block is already cached
+ *                or its set is not sampled.
+ */
+static long prefetchFill(Sim *sim, unsigned long long block, int now) {
+	Cache *cache = sim->cache;
+	unsigned long long addr = block << cache->b;
+	int setIndex = getSet(cache, addr);
+	unsigned long long tag = getTag(cache, addr);
+
+	if (((size_t) setIndex & sim->sampleMask) || cacheFindWay(cache, setIndex, tag) >= 0) {
+		return -1;
+	}
+	int dirty = 0;
+	if (sim->victims && victimTake(sim->victims, block, &dirty)) {
+		++(sim->counts.victimHits);
+	} else {
+		++(sim->counts.memReads);
+	}
+	int way = cacheFindInvalid(cache, setIndex);
+	if (way >= 0) {
+		cacheSetBit(cache->valid, cache, setIndex, way);
+	} else {
+		way = sim->policy->victim(sim->policy, cache, setIndex);
+		int evictedDirty = cacheTestBit(cache->dirty, cache, setIndex, way);
+		sim->counts.dirtyEvicted += evictedDirty;
+		++(sim->counts.evictions);
+		retire(sim, &sim->counts, lineBlock(cache, setIndex, way), evictedDirty);
+	}
+	long slot = (long) (setIndex * cache->stride + way);
+	sim->counts.prefetch.polluting += sim->prefetchedAt[slot] != 0;
+	cacheTags(cache, setIndex)[way] = tag;
+	if (dirty) {
+		cacheSetBit(cache->dirty, cache, setIndex, way);
+		++(sim->counts.dirtied);
+	} else {
+		cacheClearBit(cache->dirty, cache, setIndex, way);
+	}
+	sim->policy->onFill(sim->policy, cache, setIndex, way, now);
+	sim->prefetchedAt[slot] = sim->now;
+	return slot;
+}
+
+/* used - Count the first demand use of a block prefetched at issuedAt */
+static void used(Sim *sim, unsigned long long issuedAt) {
+	++(sim->counts.prefetch.useful);
+	if (sim->now - issuedAt < (unsigned long long) sim->prefetchLatency) {
+		++(sim->counts.prefetch.late);
+	}
+}
+
+/*
+ * accessPrefetching - accessCache with the prefetcher alongside: a miss
+ *                     may be served by a stream buffer (then it is a
+ *                     hit), lines prefetched and not yet used are
+ *                     tracked, and the blocks the prefetcher asks for
+ *                     are filled after the demand access.
+ */
+static SimOutcome accessPrefetching(Sim *sim, unsigned long long addr, int size,
+	int isWrite, int now, MissClass cls) {
+	Cache *cache = sim->cache;
+	int setIndex = getSet(cache, addr);
+	size_t base = setIndex * cache->stride;
+	int way = cacheFindWay(cache, setIndex, getTag(cache, addr));
+	PrefetchTrigger trigger = way >= 0 ? PREFETCH_HIT : PREFETCH_MISS;
+	unsigned long long blocks[PREFETCH_MAX];
+	unsigned long long issuedAt;
+	int count;
+	int i;
+
+	if (way >= 0 && sim->prefetchedAt[base + way]) {
+		used(sim, sim->prefetchedAt[base + way]);
+		sim->prefetchedAt[base + way] = 0;
+		trigger = PREFETCH_FIRST_USE;
+	} else if (way < 0 && prefetcherHasBuffers(sim->prefetcher) &&
+		prefetcherLookup(sim->prefetcher, addr, sim->now, &issuedAt,
+			&sim->counts.prefetch)) {
+		// the buffer hands the block over, so the access below hits it
+		long slot = prefetchFill(sim, addr >> cache->b, now);
+		if (slot >= 0) {
+			sim->prefetchedAt[slot] = 0;
+		}
+		used(sim, issuedAt);
+		trigger = PREFETCH_FIRST_USE;
+	}
+
+	SimOutcome outcome = accessCache(sim, addr, size, isWrite, now, cls, sim->policy,
+		&sim->counts, sim->regionCounts);
+	way = outcome == SIM_HIT ? -1 : cacheFindWay(cache, setIndex, getTag(cache, addr));
+	if (way >= 0) {
+		// the way filled held the victim, which may not have been used
+		sim->counts.prefetch.polluting += sim->prefetchedAt[base + way] != 0;
+		sim->prefetchedAt[base + way] = 0;
+	}
+
+	count = prefetcherAccess(sim->prefetcher, addr, trigger, blocks);
+	for (i = 0; i < count; i++) {
+		if (prefetchFill(sim, blocks[i], now) >= 0) {
+			++(sim->counts.prefetch.issued);
+		}
+	}
+	return outcome;
+}
+
+static void *runWorker(void *arg) {
+	Worker *worker = (Worker *) arg;
+	Ring *ring = &worker->ring;
+	int observed = worker->sim->observer != NULL;
+	size_t ready;
+	size_t i;
+
+	while ((ready = ringWait(ring)) > 0) {
+		// hand slots back in slices so the router never waits long
+		if (ready > TRACE_BATCH) {
+			ready = TRACE_BATCH;
+		}
+		for (i = 0; i < ready; i++) {
+			const RingEntry *entry = &ring->slots[(ring->head + i) & (RING_SIZE - 1)];
+			// sizes only matter to the write paths that keep a sim serial
+			SimOutcome outcome = accessCache(worker->sim, entry->addr, 0,
+				entry->op == 'S', entry->seq, (MissClass) entry->tag,
+				worker->policy, &worker->counts, worker->regionCounts);
+			if (!observed) {
+				continue;
+			}
+			// the router replays the logs before SIM_LOG_LIMIT accesses pass
+			LoggedAccess *logged = &worker->log[worker->logCount++];
+			logged->addr = entry->addr;
+			logged->seq = entry->seq;
+			logged->op = entry->op;
+			logged->outcome = outcome;
+		}
+		ringRelease(ring, ready);
+	}
+	return NULL;
+}
+
+/*
+ * replayLogs - Pass the workers' logs to the observer in trace order.
+ *              Each log is already sorted by sequence number, so this
+ *              is a merge.
+ */
+static void replayLogs(Sim *sim) {
+	int w;
+	for (;;) {
+		Worker *first = NULL;
+		for (w = 0; w < sim->workerCount; w++) {
+			Worker *worker = &sim->workers[w];
+			if (worker->logNext < worker->logCount && (!first ||
+				worker->log[worker->logNext].seq < first->log[first->logNext].seq)) {
+				first = worker;
+			}
+		}
+		if (!first) {
+			break;
+		}
+		const LoggedAccess *logged = &first->log[first->logNext++];
+		sim->observer(sim->observerCtx, logged->op, logged->addr,
+			(SimOutcome) logged->outcome);
+	}
+	for (w = 0; w < sim->workerCount; w++) {
+		sim->workers[w].logCount = 0;
+		sim->workers[w].logNext = 0;
+	}
+}
+
+/* The policy clock at the current access */
+static inline int policyTime(const Sim *sim) {
+	return (int) (sim->now - sim->clockBase);
+}
+
+/*
+ * dispatch - Simulate, or route to the owning worker, one probe of size
+ *            bytes at sim->now
+ */
+static void dispatch(Sim *sim, char op, unsigned long long addr, int size) {
+	if (sim->tlb) {
+		addr = tlbTranslate(sim->tlb, addr);
+	}
+	if ((size_t) getSet(sim->cache, addr) & sim->sampleMask) {
+		return;
+	}
+	// the shadow cache is global, so it always runs on this thread
+	MissClass cls = sim->classifier ?
+		classifierAccess(sim->classifier, addr) : MISS_CLASSES;
+	if (sim->workers) {
+		size_t owner = ((size_t) getSet(sim->cache, addr) * sim->workerCount)
+			>> sim->cache->s;
+		ringPush(&sim->workers[owner].ring, addr, policyTime(sim), op, (char) cls);
+		return;
+	}
+	SimOutcome outcome = sim->prefetcher ?
+		accessPrefetching(sim, addr, size, op == 'S', policyTime(sim), cls) :
+		accessCache(sim, addr, size, op == 'S', policyTime(sim), cls,
+			sim->policy, &sim->counts, sim->regionCounts);
+	if (sim->observer) {
+		sim->observer(sim->observerCtx, op, addr, outcome);
+	}
+}
+
+/* totals - Wait for the workers to catch up and sum every thread's counts */
+static void totals(Sim *sim, Counts *total) {
+	int w;
+
+	*total = sim->counts;
+	for (w = 0; w < sim->workerCount; w++) {
+		ringDrain(&sim->workers[w].ring);
+		countsAdd(total, &sim->workers[w].counts);
+	}
+}
+
+static void fillStats(const Sim *sim, const Counts *counts, SimStats *stats) {
+	stats->hits = counts->hits;
+	stats->misses = counts->misses;
+	stats->evictions = counts->evictions;
+	stats->dirtyBytesInCache = (counts->dirtied - counts->dirtyEvicted) << sim->cache->b;
+	stats->dirtyBytesEvicted = counts->dirtyEvicted << sim->cache->b;
+	stats->compulsory = counts->classes[MISS_COMPULSORY];
+	stats->capacity = counts->classes[MISS_CAPACITY];
+	stats->conflict = counts->classes[MISS_CONFLICT];
+	stats->prefetchIssued = counts->prefetch.issued;
+	stats->prefetchUseful = counts->prefetch.useful;
+	stats->prefetchLate = counts->prefetch.late;
+	stats->prefetchPolluting = counts->prefetch.polluting;
+	stats->victimHits = counts->victimHits;
+	stats->memReadBytes = counts->memReads << sim->cache->b;
+	stats->memWriteBytes = counts->memWriteBytes;
+}
+
+/*
+ * takeSnapshot - Hand the snapshot callback what changed since the
+ *                previous snapshot. Dirty bytes in cache is a level,
+ *                not a change, so it is passed as it stands.
+ */
+static void takeSnapshot(Sim *sim) {
+	Counts total;
+	Counts delta;
+	SimStats stats;
+
+	totals(sim, &total);
+	delta = total;
+	countsSub(&delta, &sim->snapshotCounts);
+	fillStats(sim, &delta, &stats);
+	stats.dirtyBytesInCache = (total.dirtied - total.dirtyEvicted) << sim->cache->b;
+	sim->snapshot(sim->snapshotCtx, sim->now, &stats);
+	sim->snapshotCounts = total;
+	sim->nextSnapshot = sim->now + sim->interval;
+}
+
+/*
+ * rebase - Renumber the policy's ranks and restart the policy clock
+ *          above them, with the workers idle. Their observer logs are
+ *          ordered by policy clock, so they are flushed first.
+ */
+static void rebase(Sim *sim) {
+	int w;
+
+	for (w = 0; w < sim->workerCount; w++) {
+		ringDrain(&sim->workers[w].ring);
+	}
+	if (sim->observer && sim->workers) {
+		replayLogs(sim);
+	}
+	sim->clockBase = sim->now - policyRebase(sim->policy, sim->cache);
+}
+
+/* replayNow - Wait for the workers and pass their logs to the observer */
+static void replayNow(Sim *sim) {
+	int w;
+
+	for (w = 0; w < sim->workerCount; w++) {
+		ringDrain(&sim->workers[w].ring);
+	}
+	replayLogs(sim);
+	sim->nextReplay = sim->now + SIM_LOG_LIMIT;
+}
+
+static void scheduleEvent(Sim *sim) {
+	sim->nextEvent = sim->clockBase + POLICY_CLOCK_LIMIT;
+	if (sim->interval && sim->nextSnapshot < sim->nextEvent) {
+		sim->nextEvent = sim->nextSnapshot;
+	}
+	if (sim->observer && sim->workers && sim->nextReplay < sim->nextEvent) {
+		sim->nextEvent = sim->nextReplay;
+	}
+}
+
+/*
+ * runEvents - Snapshot when an interval ends, replay the workers' logs
+ *             before they fill, rebase before the policy clock runs out
+ */
+static void runEvents(Sim *sim) {
+	if (sim->interval && sim->now == sim->nextSnapshot) {
+		takeSnapshot(sim);
+	}
+	if (sim->observer && sim->workers && sim->now == sim->nextReplay) {
+		replayNow(sim);
+	}
+	if (sim->now - sim->clockBase >= POLICY_CLOCK_LIMIT) {
+		rebase(sim);
+	}
+	scheduleEvent(sim);
+}
+
+/* tick - Advance the access clock, first running any event due */
+static inline void tick(Sim *sim) {
+	if (sim->now == sim->nextEvent) {
+		runEvents(sim);
+	}
+	sim->now++;
+}
+
+static void splitProbe(void *target, char op, unsigned long long addr) {
+	Sim *sim = (Sim *) target;
+	unsigned long long next = ((addr >> sim->cache->b) + 1) << sim->cache->b;
+	tick(sim);
+	// the probe covers the record's bytes up to the end of its block
+	dispatch(sim, op, addr, (int) ((sim->splitEnd < next ? sim->splitEnd : next) - addr));
+}
+
+static void stopWorkers(Sim *sim) {
+	int w;
+	for (w = 0; w < sim->workerCount; w++) {
+		ringFinish(&sim->workers[w].ring);
+	}
+	for (w = 0; w < sim->workerCount; w++) {
+		pthread_join(sim->workers[w].thread, NULL);
+		ringFree(&sim->workers[w].ring);
+		policyFree(sim->workers[w].policy);
+		free(sim->workers[w].regionCounts);
+		free(sim->workers[w].log);
+	}
+	free(sim->workers);
+	sim->workers = NULL;
+	sim->workerCount = 0;
+}
+
+static int startWorkers(Sim *sim, int count) {
+	sim->workers = (Worker *) calloc(count, sizeof(Worker));
+	if (!sim->workers) {
+		return 0;
+	}
+	while (sim->workerCount < count) {
+		Worker *worker = &sim->workers[sim->workerCount];
+		worker->sim = sim;
+		worker->policy = policyFork(sim->policy, sim->workerCount + 1);
+		if (sim->regionCount) {
+			worker->regionCounts = (Counts *) calloc(sim->regionCount, sizeof(Counts));
+		}
+		if (sim->observer) {
+			worker->log = (LoggedAccess *) malloc(SIM_LOG_LIMIT * sizeof(LoggedAccess));
+		}
+		if (!worker->policy || (sim->regionCount && !worker->regionCounts) ||
+			(sim->observer && !worker->log) ||
+			!ringInit(&worker->ring) ||
+			pthread_create(&worker->thread, NULL, runWorker, worker) != 0) {
+			policyFree(worker->policy);
+			free(worker->regionCounts);
+			free(worker->log);
+			ringFree(&worker->ring);
+			stopWorkers(sim);
+			return 0;
+		}
+		sim->workerCount++;
+	}
+	return 1;
+}
+
+/*
+ * runKernel - simAccess for a plain LRU sim (no threads, splitting,
+ *             observer or optional counters) with the geometry given as
+ *             constants. Every SIM_KERNELS instance inlines this with
+ *             its own s, E and b, so masks and shifts fold into
+ *             immediates and the way loops unroll; a direct-mapped
+ *             cache needs no replacement state at all. The outcome is
+ *             exactly that of accessCache under LRU.
+ */
+static inline __attribute__((always_inline)) void runKernel(Sim *sim,
+	const TraceRecord *recs, size_t count, const int s, const int E, const int b) {
+	Cache *cache = sim->cache;
+	Counts *counts = &sim->counts;
+	const unsigned long long used = E < 64 ? (1ULL << E) - 1 : ~0ULL;
+	int now = policyTime(sim);
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		const TraceRecord *rec = &recs[i];
+		now++;
+		if (rec->op != 'L' && rec->op != 'S') {
+			continue;
+		}
+		size_t set = (size_t) (rec->addr >> b) & ((1ULL << s) - 1);
+		unsigned long long tag = ((1ULL << (63 - s - b)) - 1) & (rec->addr >> (s + b));
+		unsigned long long *tags = cache->tags + set * cache->stride;
+		int *rank = cache->rank + set * cache->stride;
+		unsigned long long *valid = &cache->valid[set];
+		unsigned long long *dirty = &cache->dirty[set];
+		unsigned long long bit;
+		int way;
+
+		for (way = 0; way < E; way++) {
+			if (tags[way] == tag && ((*valid >> way) & 1)) {
+				break;
+			}
+		}
+		if (way < E) {
+			bit = 1ULL << way;
+			if (rec->op == 'S' && !(*dirty & bit)) {
+				counts->dirtied++;
+				*dirty |= bit;
+			}
+			if (E > 1) {
+				rank[way] = now;
+			}
+			counts->hits++;
+			continue;
+		}
+
+		unsigned long long empty = ~*valid & used;
+		if (empty) {
+			way = __builtin_ctzll(empty);
+			*valid |= 1ULL << way;
+		} else {
+			int w;
+			way = 0;
+			for (w = 1; w < E; w++) {
+				if (rank[w] < rank[way]) {
+					way = w;
+				}
+			}
+			counts->dirtyEvicted += (*dirty >> way) & 1;
+			counts->memWriteBytes += ((*dirty >> way) & 1) << b;
+			counts->evictions++;
+		}
+		bit = 1ULL << way;
+		tags[way] = tag;
+		if (rec->op == 'S') {
+			*dirty |= bit;
+			counts->dirtied++;
+		} else {
+			*dirty &= ~bit;
+		}
+		if (E > 1) {
+			rank[way] = now;
+		}
+		counts->memReads++;
+		counts->misses++;
+	}
+	sim->now += count;
+}
+
+/*
+ * The geometries with a specialized kernel: test-trans's graded cache
+ * (s=5, E=1, b=6) and its neighbours, then typical L1 and L2 shapes.
+ * Each must have E <= 64 so a set's valid and dirty bits fit one word.
+ */
+#define SIM_KERNELS(X) \
+	X(5, 1, 6) \
+	X(5, 1, 5) \
+	X(5, 2, 6) \
+	X(5, 4, 6) \
+	X(6, 1, 6) \
+	X(6, 8, 6) \
+	X(7, 8, 6) \
+	X(10, 8, 6) \
+	X(10, 16, 6)
+
+/* Most records a kernel runs between policy clock checks */
+#define KERNEL_CHUNK (POLICY_CLOCK_LIMIT / 2 < TRACE_BATCH ? POLICY_CLOCK_LIMIT / 2 : TRACE_BATCH)
+
+#define SIM_KERNEL_FUNCTION(s, E, b) \
+	static void kernel_##s##_##E##_##b(Sim *sim, const TraceRecord *recs, size_t count) { \
+		runKernel(sim, recs, count, s, E, b); \
+	}
+SIM_KERNELS(SIM_KERNEL_FUNCTION)
+
+typedef struct KernelEntry {
+	int s;
+	int E;
+	int b;
+	void (*run)(Sim *sim, const TraceRecord *recs, size_t count);
+	const char *name;
+} KernelEntry;
+
+#define SIM_KERNEL_ENTRY(s, E, b) \
+	{s, E, b, kernel_##s##_##E##_##b, "s" #s "E" #E "b" #b},
+static const KernelEntry kernels[] = {
+	SIM_KERNELS(SIM_KERNEL_ENTRY)
+};
+
+/* Whether the sim keeps state across sets, so runs on the calling thread */
+static int serialOnly(const Sim *sim) {
+	return sim->prefetcher || sim->victims || sim->combiner || sim->writeThrough ||
+		sim->noWriteAllocate;
+}
+
+/*
+ * selectKernel - Pick the specialized kernel for sim's geometry when
+ *                nothing rules the fast path out, else leave the
+ *                generic one.
+ */
+static void selectKernel(Sim *sim, const SimConfig *config) {
+	size_t k;
+
+	sim->kernelName = "generic";
+	if (config->generic || sim->workers || sim->split || sim->observer ||
+		sim->classifier || sim->setCounts || sim->sampleMask || sim->regionCount ||
+		sim->interval || serialOnly(sim) || sim->tlb || strcmp(sim->policy->name, "lru") != 0) {
+		return;
+	}
+	for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+		if (kernels[k].s == config->s && kernels[k].E == config->E &&
+			kernels[k].b == config->b) {
+			sim->kernel = kernels[k].run;
+			sim->kernelName = kernels[k].name;
+			return;
+		}
+	}
+}
+
+Sim *simCreate(const SimConfig *config) {
+	if (config->s < 0 || config->b < 0 || config->E <= 0 || config->s + config->b >= 63) {
+		return NULL;
+	}
+	Sim *sim = (Sim *) calloc(1, sizeof(Sim));
+	if (!sim) {
+		return NULL;
+	}
+	sim->split = config->split;
+	sim->observer = config->observer;
+	sim->observerCtx = config->observerCtx;
+	if (config->interval > 0 && config->snapshot) {
+		sim->interval = config->interval;
+		sim->nextSnapshot = config->interval;
+		sim->snapshot = config->snapshot;
+		sim->snapshotCtx = config->snapshotCtx;
+	}
+	scheduleEvent(sim);
+	sim->cache = cacheInit(config->s, config->E, config->b);
+	sim->policy = sim->cache ?
+		policyCreate(config->policy ? config->policy : "lru", sim->cache) : NULL;
+	if (!sim->policy) {
+		simDestroy(sim);
+		return NULL;
+	}
+	if (config->sampleSets > 1) {
+		if ((config->sampleSets & (config->sampleSets - 1)) != 0 ||
+			(size_t) config->sampleSets > sim->cache->sets) {
+			simDestroy(sim);
+			return NULL;
+		}
+		sim->sampleMask = config->sampleSets - 1;
+	}
+	if (config->prefetch && sim->sampleMask) {
+		// prefetches cross into unsampled sets, so no estimate would hold
+		simDestroy(sim);
+		return NULL;
+	}
+	if ((config->victimLines || config->combineLines) && sim->sampleMask) {
+		// shared by every set, they would serve the sampled ones alone
+		simDestroy(sim);
+		return NULL;
+	}
+	if (config->classify) {
+		// shadow only as many blocks as the sampled sets hold
+		sim->classifier = classifierCreate(
+			sim->cache->sets / (sim->sampleMask + 1) * config->E, config->b);
+		if (!sim->classifier) {
+			simDestroy(sim);
+			return NULL;
+		}
+	}
+	if (config->classify || config->perSet || sim->sampleMask) {
+		sim->setCounts = (SetCounts *) calloc(sim->cache->sets, sizeof(SetCounts));
+		if (!sim->setCounts) {
+			simDestroy(sim);
+			return NULL;
+		}
+	}
+	if (config->regionCount > 0) {
+		sim->regions = (SimRegion *) malloc(config->regionCount * sizeof(SimRegion));
+		sim->regionCounts = (Counts *) calloc(config->regionCount, sizeof(Counts));
+		if (!sim->regions || !sim->regionCounts) {
+			simDestroy(sim);
+			return NULL;
+		}
+		memcpy(sim->regions, config->regions, config->regionCount * sizeof(SimRegion));
+		sim->regionCount = config->regionCount;
+	}
+
+	if (config->prefetch) {
+		sim->prefetcher = prefetcherCreate(config->prefetch, config->b);
+		sim->prefetchedAt = (unsigned long long *) calloc(
+			sim->cache->sets * sim->cache->stride, sizeof(unsigned long long));
+		if (!sim->prefetcher || !sim->prefetchedAt) {
+			simDestroy(sim);
+			return NULL;
+		}
+		sim->prefetchLatency = config->prefetchLatency;
+	}
+	sim->writeThrough = config->writeThrough;
+	sim->noWriteAllocate = config->noWriteAllocate;
+	if (config->victimLines > 0) {
+		sim->victims = victimCreate(config->victimLines);
+		if (!sim->victims) {
+			simDestroy(sim);
+			return NULL;
+		}
+	}
+	if (config->combineLines > 0) {
+		sim->combiner = writeBufferCreate(config->combineLines, config->b);
+		if (!sim->combiner) {
+			simDestroy(sim);
+			return NULL;
+		}
+	}
+
+	if (config->tlb) {
+		sim->tlb = tlbCreate(config->tlb, config->s + config->b);
+		if (!sim->tlb) {
+			simDestroy(sim);
+			return NULL;
+		}
+	}
+
+	// prefetches, the buffers and stores sent to memory cross sets
+	int threads = serialOnly(sim) ? 1 : config->threads;
+	if ((size_t) threads > sim->cache->sets) {
+		threads = (int) sim->cache->sets;
+	}
+	if (threads > 1 && !startWorkers(sim, threads)) {
+		simDestroy(sim);
+		return NULL;
+	}
+	sim->nextReplay = SIM_LOG_LIMIT;
+	scheduleEvent(sim);
+	selectKernel(sim, config);
+	return sim;
+}
+
+void simAccess(Sim *sim, const TraceRecord *recs, size_t count) {
+	size_t i;
+	int w;
+
+	if (sim->kernel) {
+		// in chunks, rebasing between them before the policy clock runs out
+		while (count > 0) {
+			size_t chunk = count < KERNEL_CHUNK ? count : KERNEL_CHUNK;
+			if (sim->now - sim->clockBase + chunk > POLICY_CLOCK_LIMIT) {
+				rebase(sim);
+			}
+			sim->kernel(sim, recs, chunk);
+			recs += chunk;
+			count -= chunk;
+		}
+		return;
+	}
+	for (i = 0; i < count; i++) {
+		const TraceRecord *rec = &recs[i];
+		if (sim->split && simNeedsSplit(rec, sim->cache->b)) {
+			sim->splitEnd = rec->addr + (rec->size ? rec->size : 1);
+			simSplit(rec, sim->cache->b, splitProbe, sim);
+			continue;
+		}
+		tick(sim);
+		if (rec->op == 'L' || rec->op == 'S') {
+			dispatch(sim, rec->op, rec->addr, rec->size);
+		}
+	}
+	for (w = 0; w < sim->workerCount; w++) {
+		ringPublish(&sim->workers[w].ring);
+	}
+}
+
+int simReplay(Sim *sim, const char *path) {
+	TraceReader *reader = traceOpen(path);
+	int replayed = reader && simReplayReader(sim, reader);
+	traceClose(reader);
+	return replayed;
+}
+
+int simReplayReader(Sim *sim, TraceReader *reader) {
+	TraceRecord *batch = (TraceRecord *) malloc(TRACE_BATCH * sizeof(TraceRecord));
+	size_t count;
+
+	if (!batch) {
+		return 0;
+	}
+	while ((count = traceRead(reader, batch, TRACE_BATCH)) > 0) {
+		simAccess(sim, batch, count);
+	}
+	free(batch);
+	return 1;
+}
+
+void simStats(Sim *sim, SimStats *stats) {
+	Counts total;
+
+	// close the interval in progress, if it has seen any access
+	if (sim->interval && sim->now != sim->nextSnapshot - sim->interval) {
+		takeSnapshot(sim);
+		scheduleEvent(sim);
+	}
+	totals(sim, &total);
+	if (sim->observer && sim->workers) {
+		replayLogs(sim);
+	}
+	fillStats(sim, &total, stats);
+}
+
+Tlb *simTlb(Sim *sim) {
+	return sim->tlb;
+}
+
+const char *simKernel(const Sim *sim) {
+	return sim->kernelName;
+}
+
+size_t simSetCount(const Sim *sim) {
+	return sim->cache->sets;
+}
+
+int simSetStats(Sim *sim, size_t set, SimSetStats *stats) {
+	int w;
+
+	if (set >= sim->cache->sets || !sim->setCounts) {
+		return 0;
+	}
+	for (w = 0; w < sim->workerCount; w++) {
+		ringDrain(&sim->workers[w].ring);
+	}
+	const SetCounts *counts = &sim->setCounts[set];
+	stats->hits = counts->hits;
+	stats->misses = counts->misses;
+	stats->evictions = counts->evictions;
+	stats->compulsory = counts->classes[MISS_COMPULSORY];
+	stats->capacity = counts->classes[MISS_CAPACITY];
+	stats->conflict = counts->classes[MISS_CONFLICT];
+	return 1;
+}
+
+/*
+ * expand - Estimate the total of x over all sets from its sum and sum
+ *          of squares over n sampled sets, setting *error to the half
+ *          width of the 95% interval of a simple random sample.
+ */
+static double expand(double sum, double squares, size_t n, size_t sets, double *error) {
+	double scale = (double) sets / n;
+	if (n == sets) {
+		*error = 0;
+	} else if (n < 2) {
+		*error = HUGE_VAL;
+	} else {
+		double variance = (squares - sum * sum / n) / (n - 1);
+		*error = SIM_Z95 * sets * sqrt((1 - (double) n / sets) * variance / n);
+	}
+	return sum * scale;
+}
+
+int simEstimate(Sim *sim, SimEstimate *estimate) {
+	double sums[3] = {0, 0, 0};
+	double squares[3] = {0, 0, 0};
+	double accesses = 0;
+	size_t n = 0;
+	size_t active = 0;
+	size_t set;
+	int w;
+
+	if (!sim->setCounts) {
+		return 0;
+	}
+	for (w = 0; w < sim->workerCount; w++) {
+		ringDrain(&sim->workers[w].ring);
+	}
+	for (set = 0; set < sim->cache->sets; set += sim->sampleMask + 1) {
+		const SetCounts *counts = &sim->setCounts[set];
+		double x[3] = {(double) counts->hits, (double) counts->misses,
+			(double) counts->evictions};
+		int i;
+		for (i = 0; i < 3; i++) {
+			sums[i] += x[i];
+			squares[i] += x[i] * x[i];
+		}
+		active += counts->hits + counts->misses > 0;
+		n++;
+	}
+	accesses = sums[0] + sums[1];
+
+	estimate->sampledSets = n;
+	estimate->activeSets = active;
+	estimate->sets = sim->cache->sets;
+	estimate->hits = expand(sums[0], squares[0], n, sim->cache->sets,
+		&estimate->hitsError);
+	estimate->misses = expand(sums[1], squares[1], n, sim->cache->sets,
+		&estimate->missesError);
+	estimate->evictions = expand(sums[2], squares[2], n, sim->cache->sets,
+		&estimate->evictionsError);
+
+	// ratio estimator: the residuals m - R a of each set give its variance
+	estimate->missRate = accesses > 0 ? sums[1] / accesses : 0;
+	estimate->missRateError = 0;
+	if (n < sim->cache->sets && n >= 2 && accesses > 0) {
+		double mean = accesses / n;
+		double residuals = 0;
+		for (set = 0; set < sim->cache->sets; set += sim->sampleMask + 1) {
+			const SetCounts *counts = &sim->setCounts[set];
+			double r = counts->misses - estimate->missRate *
+				(double) (counts->hits + counts->misses);
+			residuals += r * r;
+		}
+		estimate->missRateError = SIM_Z95 * sqrt((1 - (double) n / sim->cache->sets) *
+			residuals / (n - 1) / n) / mean;
+	} else if (n < sim->cache->sets && accesses > 0) {
+		estimate->missRateError = HUGE_VAL;
+	}
+	if (n < sim->cache->sets && active < SIM_MIN_ACTIVE_SETS) {
+		estimate->hitsError = HUGE_VAL;
+		estimate->missesError = HUGE_VAL;
+		estimate->evictionsError = HUGE_VAL;
+		estimate->missRateError = HUGE_VAL;
+	}
+	return 1;
+}
+
+int simRegionStats(Sim *sim, int region, SimRegionStats *stats) {
+	Counts total;
+	int w;
+
+	if (region < 0 || region >= sim->regionCount) {
+		return 0;
+	}
+	total = sim->regionCounts[region];
+	for (w = 0; w < sim->workerCount; w++) {
+		ringDrain(&sim->workers[w].ring);
+		countsAdd(&total, &sim->workers[w].regionCounts[region]);
+	}
+	stats->hits = total.hits;
+	stats->misses = total.misses;
+	stats->evictions = total.evictions;
+	stats->compulsory = total.classes[MISS_COMPULSORY];
+	stats->capacity = total.classes[MISS_CAPACITY];
+	stats->conflict = total.classes[MISS_CONFLICT];
+	return 1;
+}
+
+int simRegionParse(const char *spec, SimRegion *region) {
+	const char *colon = strrchr(spec, ':');
+	char *end;
+
+	if (!colon || colon == spec || colon - spec >= SIM_REGION_NAME) {
+		return 0;
+	}
+	region->start = strtoull(colon + 1, &end, 16);
+	if (end == colon + 1 || *end != '-') {
+		return 0;
+	}
+	const char *hi = end + 1;
+	region->end = strtoull(hi, &end, 16);
+	if (end == hi || *end != '\0' || region->end <= region->start) {
+		return 0;
+	}
+	memcpy(region->name, spec, colon - spec);
+	region->name[colon - spec] = '\0';
+	return 1;
+}
+
+void simDestroy(Sim *sim) {
+	if (!sim) {
+		return;
+	}
+	if (sim->workers) {
+		stopWorkers(sim);
+	}
+	policyFree(sim->policy);
+	cacheFree(sim->cache);
+	classifierFree(sim->classifier);
+	free(sim->setCounts);
+	free(sim->regions);
+	free(sim->regionCounts);
+	prefetcherFree(sim->prefetcher);
+	free(sim->prefetchedAt);
+	victimFree(sim->victims);
+	writeBufferFree(sim->combiner);
+	tlbFree(sim->tlb);
+	free(sim);
+}
+
+void simSplit(const TraceRecord *rec, int bits, SimProbe probe, void *target) {
+	unsigned long long first = rec->addr >> bits;
+	unsigned long long last = first;
+	unsigned long long block;
+	int pass;
+
+	if (rec->op != 'L' && rec->op != 'S' && rec->op != 'M') {
+		return;
+	}
+	if (rec->size > 1 && rec->addr + rec->size - 1 > rec->addr) {
+		last = (rec->addr + rec->size - 1) >> bits;
+	}
+	for (pass = 0; pass < (rec->op == 'M' ? 2 : 1); pass++) {
+		char op = rec->op == 'M' ? (pass ? 'S' : 'L') : rec->op;
+		probe(target, op, rec->addr);
+		for (block = first + 1; block <= last; block++) {
+			probe(target, op, block << bits);
+		}
+	}
+}
@@ -0,0 +1,259 @@
+/*
+ * sim.h - Reentrant cache simulator library (libcsim)
+ *
+ * Everything one simulated cache needs - geometry, storage,
+ * replacement state, clock, statistics and worker threads - lives in
+ * an opaque Sim handle, so a process can run any number of them side
+ * by side. csim is a thin command line driver over this API; build
+ * libcsim.a or libcsim.so to embed it elsewhere.
+ *
+ *     SimConfig config = {.s = 5, .E = 1, .b = 5};
+ *     Sim *sim = simCreate(&config);
+ *     simAccess(sim, records, count);    // as many batches as needed
+ *     simStats(sim, &stats);
+ *     simDestroy(sim);
+ *
+ * With classify set, a shadow fully associative LRU cache of the same
+ * capacity (classify.h) runs alongside, on the calling thread, and
+ * every miss is counted as compulsory, capacity or conflict.
+ *
+ * With sampleSets above 1 only the sets whose index is a multiple of
+ * it are simulated: any other access is dropped after computing its
+ * set, before the tag lookup, the shadow cache or the observer.
+ * simStats then counts the sampled sets alone and simEstimate scales
+ * them up to the whole cache.
+ *
+ * Plain LRU sims of the most common geometries (see SIM_KERNELS in
+ * sim.c) run through kernels compiled with s, E and b as constants;
+ * everything else takes the generic path. Both count exactly alike.
+ *
+ * With prefetch set, a prefetcher (prefetch.h) fills lines ahead of
+ * the demand accesses, always on the calling thread. Its fills may
+ * evict lines, which evictions counts, but they are neither hits nor
+ * misses, so they are left out of the per-set, per-region and class
+ * counters. A prefetched line used within prefetchLatency accesses of
+ * its issue is counted late, though still as a hit. Prefetches land in
+ * other sets than the accesses that trigger them, so prefetch cannot be
+ * combined with sampleSets.
+ *
+ * Stores write back and allocate unless writeThrough or noWriteAllocate
+ * say otherwise. memWriteBytes counts the bytes sent to memory: whole
+ * blocks for write-backs, the bytes stored (clipped to the block) for
+ * write-through and non-allocating stores, or what the write-combining
+ * buffer flushes. Dirty lines still cached and stores still pending in
+ * the buffer are not counted. These write paths, the victim cache and
+ * the buffer all run on the calling thread, like prefetching. The
+ * victim cache and the buffer are shared by every set, so neither can
+ * be combined with sampleSets.
+ *
+ * With tlb set, every probe is translated (tlb.h) on the calling
+ * thread before anything else looks at it, so sampling, the shadow
+ * cache, regions and the observer all see physical addresses.
+ *
+ * perSet and regions keep flat arrays of counters indexed by set and by
+ * region, allocated up front, so they are cheap enough to leave on.
+ * Regions are matched in order, the first holding an address wins.
+ *
+ * A single Sim must not be used by several threads at once.
+ */
+#ifndef SIM_H
+#define SIM_H
+
+#include <stddef.h>
+
+#include "tracereader.h"
+#include "tlb.h"
+
+typedef struct Sim Sim;
+
+typedef enum SimOutcome {
+	SIM_HIT,
+	SIM_MISS,
+	SIM_EVICTION
+} SimOutcome;
+
+/* Told about each load or store simulated, in trace order */
+typedef void (*SimObserver)(void *ctx, char op, unsigned long long addr,
+	SimOutcome outcome);
+
+typedef struct SimStats {
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+	unsigned long long dirtyBytesInCache;
+	unsigned long long dirtyBytesEvicted;
+	unsigned long long compulsory;  /* misses by cause, with classify set */
+	unsigned long long capacity;
+	unsigned long long conflict;
+	unsigned long long prefetchIssued;      /* with prefetch set, see prefetch.h */
+	unsigned long long prefetchUseful;
+	unsigned long long prefetchLate;
+	unsigned long long prefetchPolluting;
+	unsigned long long victimHits;      /* misses the victim cache served */
+	unsigned long long memReadBytes;    /* fills from memory, in bytes */
+	unsigned long long memWriteBytes;   /* write-backs and write-through stores */
+} SimStats;
+
+/*
+ * Told every interval accesses what changed over them: counters are
+ * deltas except dirtyBytesInCache, which is the current level. now is
+ * the access clock at the end of the interval.
+ */
+typedef void (*SimSnapshot)(void *ctx, unsigned long long now,
+	const SimStats *delta);
+
+/* Longest region name, with its terminator */
+#define SIM_REGION_NAME 32
+
+/* An address range [start, end) counted on its own, e.g. one array */
+typedef struct SimRegion {
+	char name[SIM_REGION_NAME];
+	unsigned long long start;
+	unsigned long long end;
+} SimRegion;
+
+typedef struct SimConfig {
+	int s;
+	int E;
+	int b;
+	const char *policy;     /* replacement policy name, NULL for lru */
+	int threads;            /* above 1, sets are split across threads */
+	int split;              /* probe every block touched, M as load+store */
+	int classify;           /* split misses into compulsory/capacity/conflict */
+	int perSet;             /* count hits, misses and evictions per set */
+	const SimRegion *regions;   /* also count them per address range */
+	int regionCount;
+	SimObserver observer;   /* optional; with threads, called by simStats */
+	void *observerCtx;
+	int interval;           /* accesses between snapshots, 0 for none */
+	SimSnapshot snapshot;
+	void *snapshotCtx;
+	int sampleSets;         /* simulate one set in sampleSets (a power of two) */
+	int generic;            /* never use a specialized kernel, for testing */
+	const char *prefetch;   /* prefetcher spec (prefetch.h), NULL for none */
+	int prefetchLatency;    /* accesses a prefetch takes to arrive, for late */
+	int writeThrough;       /* stores also write memory, lines never get dirty */
+	int noWriteAllocate;    /* store misses write memory and fill no line */
+	int victimLines;        /* fully associative victim cache (buffers.h), 0 for none */
+	int combineLines;       /* write-combining buffer for stores to memory */
+	const TlbConfig *tlb;   /* translate addresses through a TLB, NULL for none */
+} SimConfig;
+
+/* Counters of one set, with perSet (or classify) set */
+typedef struct SimSetStats {
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+	unsigned long long compulsory;  /* zero unless classify is set */
+	unsigned long long capacity;
+	unsigned long long conflict;
+} SimSetStats;
+
+typedef struct SimRegionStats {
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+	unsigned long long compulsory;  /* zero unless classify is set */
+	unsigned long long capacity;
+	unsigned long long conflict;
+} SimRegionStats;
+
+/*
+ * Sampled sets that must see accesses before simEstimate gives finite
+ * intervals: with fewer, the few busy sets dominate and the normal
+ * approximation behind the intervals does not hold
+ */
+#define SIM_MIN_ACTIVE_SETS 30
+
+/*
+ * Totals extrapolated from the simulated sets, each with the half-width
+ * of its 95% confidence interval (0 when every set was simulated,
+ * HUGE_VAL when fewer than SIM_MIN_ACTIVE_SETS sampled sets saw accesses)
+ */
+typedef struct SimEstimate {
+	size_t sampledSets;
+	size_t activeSets;      /* sampled sets with at least one access */
+	size_t sets;
+	double hits;
+	double hitsError;
+	double misses;
+	double missesError;
+	double evictions;
+	double evictionsError;
+	double missRate;
+	double missRateError;
+} SimEstimate;
+
+/* Receives the per-block probes of a split trace record */
+typedef void (*SimProbe)(void *target, char op, unsigned long long addr);
+
+/* Returns NULL for an invalid geometry, unknown policy or when out of memory */
+Sim *simCreate(const SimConfig *config);
+
+/* Simulate a batch of trace records; ops other than L, S (and M) are skipped */
+void simAccess(Sim *sim, const TraceRecord *recs, size_t count);
+
+/* Replay a whole trace file ("-" for stdin). Returns 0 if it cannot be read */
+int simReplay(Sim *sim, const char *path);
+
+/* Replay everything left in reader, e.g. a pipe from a trace generator */
+int simReplayReader(Sim *sim, TraceReader *reader);
+
+/*
+ * simStats - Statistics so far; waits for worker threads to catch up
+ *            first, and closes the current snapshot interval early
+ */
+void simStats(Sim *sim, SimStats *stats);
+
+/* The TLB translating accesses, for its statistics, or NULL without one */
+Tlb *simTlb(Sim *sim);
+
+/* Name of the kernel simulating accesses, such as "s5E1b6" or "generic" */
+const char *simKernel(const Sim *sim);
+
+/* Number of sets, the bound for simSetStats */
+size_t simSetCount(const Sim *sim);
+
+/*
+ * simSetStats - Statistics of one set so far, like simStats. Returns 0
+ *               when set is out of range or the sim keeps no per-set
+ *               counters (neither perSet nor classify).
+ */
+int simSetStats(Sim *sim, size_t set, SimSetStats *stats);
+
+/*
+ * simEstimate - Extrapolate the statistics of the sampled sets to the
+ *               whole cache. Returns 0 when the sim keeps no per-set
+ *               counters (sampling, perSet or classify turn them on).
+ */
+int simEstimate(Sim *sim, SimEstimate *estimate);
+
+/* Statistics of regions[region] so far. Returns 0 when out of range */
+int simRegionStats(Sim *sim, int region, SimRegionStats *stats);
+
+/*
+ * simRegionParse - Parse "name:start-end", addresses in hex (0x
+ *                  optional), into region. Returns 0 if spec is
+ *                  malformed or the name too long.
+ */
+int simRegionParse(const char *spec, SimRegion *region);
+
+void simDestroy(Sim *sim);
+
+/*
+ * simNeedsSplit - Whether rec is an M or touches more than one block of
+ *                 2^bits bytes; everything else is a single probe.
+ */
+static inline int simNeedsSplit(const TraceRecord *rec, int bits) {
+	return rec->op == 'M' ||
+		(rec->size > 1 && ((rec->addr ^ (rec->addr + rec->size - 1)) >> bits) != 0);
+}
+
+/*
+ * simSplit - Send probe one L or S per block of 2^bits bytes that rec
+ *            touches, in address order. An M probes every block as a
+ *            load and then every block as a store.
+ */
+void simSplit(const TraceRecord *rec, int bits, SimProbe probe, void *target);
+
+#endif /* SIM_H */
@@ -0,0 +1,314 @@
+/*
+ * stackdist.c - Single-pass LRU simulation of many cache geometries
+ *
+ * Each set numbers its accesses with a private clock. A Fenwick tree
+ * over those slots marks the slot holding the latest access of every
+ * block seen in the set, so the stack distance of a re-access is the
+ * number of marks after the block's previous slot: one prefix query
+ * and two point updates, O(log n) per access. When a set runs out of
+ * slots the live marks are renumbered densely (growing the tree if
+ * more than half of it is live), so memory stays proportional to the
+ * number of distinct blocks rather than the trace length.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "stackdist.h"
+
+#define INITIAL_SLOTS 16
+#define INITIAL_MAP 1024
+
+typedef struct SetStack {
+	int *tree;                  /* Fenwick tree over slots 1..cap */
+	unsigned long long *owner;  /* block + 1 whose latest access is in a slot */
+	int cap;
+	int now;                    /* last slot handed out */
+	int live;                   /* distinct blocks seen in the set */
+} SetStack;
+
+/* Open-addressed map from block to the slot of its latest access */
+typedef struct BlockMap {
+	unsigned long long *keys;   /* block + 1, 0 marks an empty bucket */
+	int *slots;
+	size_t cap;
+	size_t used;
+} BlockMap;
+
+typedef struct StackConfig {
+	int s;
+	int b;
+	SetStack *sets;
+	BlockMap map;
+	unsigned long long *hist;   /* accesses per distance below maxE */
+	unsigned long long far;     /* re-accesses at distance maxE or more */
+	unsigned long long cold;
+} StackConfig;
+
+struct StackSweep {
+	StackConfig *configs;
+	int count;
+	int maxE;
+};
+
+static size_t hashBlock(unsigned long long block, size_t cap) {
+	block *= 0x9e3779b97f4a7c15ULL;
+	return (size_t) (block >> 32) & (cap - 1);
+}
+
+static int mapGrow(BlockMap *map) {
+	size_t cap = map->cap ? map->cap * 2 : INITIAL_MAP;
+	unsigned long long *keys = (unsigned long long *) calloc(cap, sizeof(unsigned long long));
+	int *slots = (int *) malloc(cap * sizeof(int));
+	if (!keys || !slots) {
+		free(keys);
+		free(slots);
+		return 0;
+	}
+	size_t i;
+	for (i = 0; i < map->cap; i++) {
+		if (map->keys[i]) {
+			size_t h = hashBlock(map->keys[i] - 1, cap);
+			while (keys[h]) {
+				h = (h + 1) & (cap - 1);
+			}
+			keys[h] = map->keys[i];
+			slots[h] = map->slots[i];
+		}
+	}
+	free(map->keys);
+	free(map->slots);
+	map->keys = keys;
+	map->slots = slots;
+	map->cap = cap;
+	return 1;
+}
+
+/*
+ * mapSlot - Slot entry of block, inserted with slot 0 if it is new.
+ *           Returns NULL when block is new and the map cannot grow;
+ *           blocks already in it are always found.
+ */
+static int *mapSlot(BlockMap *map, unsigned long long block) {
+	if (!map->cap && !mapGrow(map)) {
+		return NULL;
+	}
+	size_t h = hashBlock(block, map->cap);
+	while (map->keys[h]) {
+		if (map->keys[h] == block + 1) {
+			return &map->slots[h];
+		}
+		h = (h + 1) & (map->cap - 1);
+	}
+	if (2 * (map->used + 1) > map->cap) {
+		if (!mapGrow(map)) {
+			return NULL;
+		}
+		// the table was rebuilt, so find the empty bucket again
+		h = hashBlock(block, map->cap);
+		while (map->keys[h]) {
+			h = (h + 1) & (map->cap - 1);
+		}
+	}
+	map->keys[h] = block + 1;
+	map->slots[h] = 0;
+	map->used++;
+	return &map->slots[h];
+}
+
+static void treeAdd(int *tree, int cap, int slot, int delta) {
+	for (; slot <= cap; slot += slot & -slot) {
+		tree[slot] += delta;
+	}
+}
+
+static int treePrefix(const int *tree, int slot) {
+	int sum = 0;
+	for (; slot > 0; slot -= slot & -slot) {
+		sum += tree[slot];
+	}
+	return sum;
+}
+
+/*
+ * compact - Renumber the live slots of a set as 1..live, growing it
+ *           when more than half the slots are live.
+ */
+static int compact(SetStack *set, BlockMap *map) {
+	int cap = set->cap ? set->cap : INITIAL_SLOTS;
+	if (set->cap && 2 * set->live > cap) {
+		cap *= 2;
+	}
+
+	int *tree = (int *) calloc(cap + 1, sizeof(int));
+	unsigned long long *owner = (unsigned long long *)
+		calloc(cap + 1, sizeof(unsigned long long));
+	if (!tree || !owner) {
+		free(tree);
+		free(owner);
+		return 0;
+	}
+
+	int next = 0;
+	int slot;
+	for (slot = 1; slot <= set->now; slot++) {
+		if (set->owner[slot]) {
+			// live blocks are in the map already, so this never grows it
+			int *entry = mapSlot(map, set->owner[slot] - 1);
+			if (!entry) {
+				free(tree);
+				free(owner);
+				return 0;
+			}
+			owner[++next] = set->owner[slot];
+			*entry = next;
+		}
+	}
+	// linear-time Fenwick build over the now dense marks
+	for (slot = 1; slot <= cap; slot++) {
+		tree[slot] += slot <= next;
+		int parent = slot + (slot & -slot);
+
+		if (parent <= cap) {
+			tree[parent] += tree[slot];
+		}
+	}
+
+	free(set->tree);
+	free(set->owner);
+	set->tree = tree;
+	set->owner = owner;
+	set->cap = cap;
+	set->now = next;
+	return 1;
+}
+
+static int configAccess(StackConfig *config, int maxE, unsigned long long addr) {
+	unsigned long long block = addr >> config->b;
+	SetStack *set = &config->sets[block & (((unsigned long long) 1 << config->s) - 1)];
+
+	if (set->now == set->cap && !compact(set, &config->map)) {
+		return 0;
+	}
+	int *entry = mapSlot(&config->map, block);
+	if (!entry) {
+		return 0;
+	}
+
+	int last = *entry;
+	if (last) {
+		int distance = set->live - treePrefix(set->tree, last);
+		if (distance < maxE) {
+			config->hist[distance]++;
+		} else {
+			config->far++;
+		}
+		treeAdd(set->tree, set->cap, last, -1);
+		set->owner[last] = 0;
+	} else {
+		config->cold++;
+		set->live++;
+	}
+
+	int slot = ++set->now;
+	treeAdd(set->tree, set->cap, slot, 1);
+	set->owner[slot] = block + 1;
+	*entry = slot;
+	return 1;
+}
+
+StackSweep *sweepCreate(const int *sList, int sCount,
+	const int *bList, int bCount, int maxE) {
+	StackSweep *sweep = (StackSweep *) calloc(1, sizeof(StackSweep));
+	if (!sweep) {
+		return NULL;
+	}
+	sweep->maxE = maxE;
+	sweep->configs = (StackConfig *) calloc(sCount * bCount, sizeof(StackConfig));
+	if (!sweep->configs) {
+		free(sweep);
+		return NULL;
+	}
+
+	int i;
+	int j;
+	for (i = 0; i < sCount; i++) {
+		for (j = 0; j < bCount; j++) {
+			StackConfig *config = &sweep->configs[sweep->count++];
+			config->s = sList[i];
+			config->b = bList[j];
+			config->sets = (SetStack *) calloc((size_t) 1 << sList[i], sizeof(SetStack));
+			config->hist = (unsigned long long *) calloc(maxE, sizeof(unsigned long long));
+			if (!config->sets || !config->hist || !mapGrow(&config->map)) {
+				sweepFree(sweep);
+				return NULL;
+			}
+		}
+	}
+	return sweep;
+}
+
+int sweepAccess(StackSweep *sweep, unsigned long long addr) {
+	int i;
+	for (i = 0; i < sweep->count; i++) {
+		if (!configAccess(&sweep->configs[i], sweep->maxE, addr)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void sweepReport(const StackSweep *sweep, const int *EList, int ECount,
+	FILE *out) {
+	int i;
+	int j;
+	for (i = 0; i < sweep->count; i++) {
+		const StackConfig *config = &sweep->configs[i];
+		size_t sets = (size_t) 1 << config->s;
+		unsigned long long total = config->cold + config->far;
+		int d;
+		for (d = 0; d < sweep->maxE; d++) {
+			total += config->hist[d];
+		}
+
+		for (j = 0; j < ECount; j++) {
+			int E = EList[j];
+			unsigned long long hits = 0;
+			unsigned long long filled = 0;
+			size_t set;
+			for (d = 0; d < E && d < sweep->maxE; d++) {
+				hits += config->hist[d];
+			}
+			// every miss evicts, except the first E fills of each set
+			for (set = 0; set < sets; set++) {
+				int live = config->sets[set].live;
+				filled += live < E ? live : E;
+			}
+			unsigned long long misses = total - hits;
+			fprintf(out, "s:%d E:%d b:%d hits:%llu misses:%llu evictions:%llu\n",
+				config->s, E, config->b, hits, misses, misses - filled);
+		}
+	}
+}
+
+void sweepFree(StackSweep *sweep) {
+	if (!sweep) {
+		return;
+	}
+	int i;
+	for (i = 0; i < sweep->count; i++) {
+		StackConfig *config = &sweep->configs[i];
+		size_t set;
+		if (config->sets) {
+			for (set = 0; set < ((size_t) 1 << config->s); set++) {
+				free(config->sets[set].tree);
+				free(config->sets[set].owner);
+			}
+		}
+		free(config->sets);
+		free(config->hist);
+		free(config->map.keys);
+		free(config->map.slots);
+	}
+	free(sweep->configs);
+	free(sweep);
+}
@@ -0,0 +1,34 @@
+/*
+ * stackdist.h - Single-pass LRU simulation of many cache geometries
+ *
+ * For every (s, b) pair the sweep records the LRU stack distance of
+ * each access within its set: the number of distinct other blocks of
+ * that set touched since the block's previous access. An access hits
+ * in an E-way LRU cache exactly when its distance is below E, so one
+ * pass over the trace yields hits, misses and evictions for every
+ * associativity at once.
+ */
+#ifndef STACKDIST_H
+#define STACKDIST_H
+
+#include <stdio.h>
+
+typedef struct StackSweep StackSweep;
+
+/*
+ * sweepCreate - Track every combination of the given set bits and block
+ *               bits; distances of maxE or more only count as misses.
+ */
+StackSweep *sweepCreate(const int *sList, int sCount,
+	const int *bList, int bCount, int maxE);
+
+/* Returns 0 when out of memory, leaving the sweep's counts incomplete */
+int sweepAccess(StackSweep *sweep, unsigned long long addr);
+
+/* Print one summary line per (s, E, b) for every E in EList */
+void sweepReport(const StackSweep *sweep, const int *EList, int ECount,
+	FILE *out);
+
+void sweepFree(StackSweep *sweep);
+
+#endif /* STACKDIST_H */
@@ -12,9 +12,11 @@
 #include <getopt.h>
 #include <sys/types.h>
 #include "cachelab.h"
+#include "sim.h"
 #include <sys/wait.h> // fir WEXITSTATUS
 #include <limits.h> // for LONG_MAX
 #include <stdbool.h>
+#include <errno.h>
 
 /* Grading parameters */
 // Number of clock cycles for hit
@@ -29,6 +31,14 @@
 #define TEST_LOG_BLOCK 6
 
 
+/* Most shapes and cache configurations a parallel sweep accepts */
+#define MAX_SHAPES 32
+#define MAX_CONFIGS 32
+
+/* Seconds before giving up, plus this many more per million elements traced */
+#define TIMEOUT 360
+#define TIMEOUT_PER_MELEMENT 10
+
 /* The description string for the transpose_submit() function that the
    student submits for credit */
 #define SUBMIT_DESCRIPTION "Transpose submission"
@@ -53,6 +63,29 @@ struct results {
 };
 static struct results results = {-1, false, LONG_MAX, LONG_MAX };
 
+/* Matrix shape and cache geometry of a parallel sweep */
+struct shape {
+    size_t M;
+    size_t N;
+};
+
+struct cache_config {
+    unsigned int s;
+    unsigned int E;
+    unsigned int b;
+};
+
+/* One function x shape x cache configuration of a parallel sweep */
+struct job {
+    int funcid;
+    struct shape shape;
+    struct cache_config config;
+    int status;             /* what trace_function returned */
+    long hits;
+    long misses;
+    long evictions;
+};
+
 /*
  * Calculates the number of clock cycles for the trace
  */
@@ -61,6 +94,67 @@ static long get_clock_cycles(long hits, long misses) {
     return clock_cycles;
 }
 
+/*
+ * trace_function - Run tracegen-ct on function i with its stdout piped
+ *     straight into an in-process simulator, so no trace file is written
+ *     and no simulator process is started. Returns tracegen-ct's exit
+ *     status (0 once the function validated) with the cache statistics
+ *     in stats, or -1 if the pipeline could not be run.
+ */
+static int trace_function(int i, unsigned int s, unsigned int E,
+                          unsigned int b, SimStats *stats) {
+    SimConfig config = { .s = s, .E = E, .b = b };
+    char m_arg[32], n_arg[32], f_arg[32];
+    int fds[2], status;
+    pid_t pid;
+
+    Sim *sim = simCreate(&config);
+    if (!sim || pipe(fds) < 0) {
+        simDestroy(sim);
+        return -1;
+    }
+    sprintf(m_arg, "%zu", M);
+    sprintf(n_arg, "%zu", N);
+    sprintf(f_arg, "%d", i);
+
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        simDestroy(sim);
+        return -1;
+    }
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execl("./tracegen-ct", "./tracegen-ct", "-M", m_arg, "-N", n_arg,
+              "-F", f_arg, (char *) NULL);
+        _exit(127);
+    }
+
+    /* Simulate the trace as it is produced */
+    close(fds[1]);
+    TraceReader *reader = traceOpenFd(fds[0]);
+    bool replayed = reader && simReplayReader(sim, reader);
+    traceClose(reader);
+    close(fds[0]);
+
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            simDestroy(sim);
+            return -1;
+        }
+    }
+    simStats(sim, stats);
+    simDestroy(sim);
+    if (!replayed || !WIFEXITED(status)) {
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
+
 /*
  * eval_perf - Evaluate the performance of the registered transpose functions
  */
@@ -68,14 +162,10 @@ static void eval_perf(unsigned int s, unsigned int E, unsigned int b,
                bool submission_only) {
     int i, flag;
     long hits, misses, evictions;
-    char cmd[334], file_name[255];
-    int rval;
+    SimStats stats;
 
     registerFunctions();
 
-    /* Open the complete trace file */
-    FILE *full_trace_fp;
-
     /* Evaluate the performance of each registered transpose function */
 
     for (i=0; i<func_counter; i++) {
@@ -86,10 +176,12 @@ static void eval_perf(unsigned int s, unsigned int E, unsigned int b,
 
         printf("\nFunction %d (%d total)\nStep 1: Validating and generating memory traces\n",i,func_counter);
 
-        sprintf(file_name, "trace.f%d", i);
-
-        sprintf(cmd, "./tracegen-ct -M %ld -N %ld -F %d > %s", M, N, i, file_name);
-        flag=WEXITSTATUS(system(cmd));
+        flag = trace_function(i, s, E, b, &stats);
+        if (flag < 0) {
+            results.correct = false;
+            printf("Cache simulator error.  Unable to trace and simulate function %d\n", i);
+            continue;
+        }
         if (0 != flag) {
             printf("Validation error at function %d! Run ./tracegen-ct -v -M %zd -N %zd -F %d for details.\n",flag-1,M,N,i);
             continue;
@@ -101,31 +193,11 @@ static void eval_perf(unsigned int s, unsigned int E, unsigned int b,
             results.correct = true;
         }
 
-
-        /* Run the reference simulator */
-        full_trace_fp = fopen(file_name, "r");
-        assert(full_trace_fp);
-
-
+        /* The trace was simulated while it was generated */
         printf("Step 2: Evaluating performance (s=%d, E=%d, b=%d)\n", s, E, b);
-        char cmd[323];
-        sprintf(cmd, "./csim-ref -s %u -E %u -b %u -t %s > /dev/null",
-                s, E, b, file_name);
-        rval = system(cmd);
-        if (rval) {
-            results.correct = false;
-            printf("Cache simulator error.  The reference simulator exited with value %d\n", rval);
-            continue;
-        }
-
-        /* Collect results from the reference simulator */
-        FILE *in_fp = fopen(".csim_results","r");
-        assert(in_fp);
-        if (3!=fscanf(in_fp, "%ld %ld %ld", &hits, &misses, &evictions)) {
-            printf("Cache simulator error.  Simulator generated invalid results\n");
-            continue;
-        }
-        fclose(in_fp);
+        hits = stats.hits;
+        misses = stats.misses;
+        evictions = stats.evictions;
         func_list[i].num_hits = hits;
         func_list[i].num_misses = misses;
         func_list[i].num_evictions = evictions;
@@ -140,17 +212,207 @@ static void eval_perf(unsigned int s, unsigned int E, unsigned int b,
     }
 }
 
+/*
+ * run_job - Evaluate one job in a child process and send the results
+ *     back over fd. The child gets its own copy of the globals, so M
+ *     and N can simply be set for the job.
+ */
+static void run_job(struct job *job, int fd) {
+    SimStats stats = { 0 };
+
+    M = job->shape.M;
+    N = job->shape.N;
+    job->status = trace_function(job->funcid, job->config.s, job->config.E,
+                                 job->config.b, &stats);
+    job->hits = stats.hits;
+    job->misses = stats.misses;
+    job->evictions = stats.evictions;
+    /* Smaller than PIPE_BUF, so this never blocks nor splits */
+    if (write(fd, job, sizeof(*job)) != sizeof(*job))
+        _exit(1);
+    _exit(0);
+}
+
+/*
+ * eval_parallel - Evaluate every function x shape x cache configuration
+ *     on a pool of at most workers processes, then print one report in
+ *     job order, however the jobs happened to finish.
+ */
+static void eval_parallel(const struct shape *shapes, int nshapes,
+                          const struct cache_config *configs, int nconfigs,
+                          int workers, bool submission_only) {
+    int i, j, k, njobs = 0, next = 0, running = 0;
+    struct job *jobs;
+    pid_t *pids;
+    int *fds, *slot_job;
+
+    registerFunctions();
+
+    jobs = calloc((size_t) nshapes * nconfigs * func_counter, sizeof(struct job));
+    pids = calloc(workers, sizeof(pid_t));
+    fds = calloc(workers, sizeof(int));
+    slot_job = calloc(workers, sizeof(int));
+    assert(jobs && pids && fds && slot_job);
+
+    for (i = 0; i < nshapes; i++)
+        for (j = 0; j < nconfigs; j++)
+            for (k = 0; k < func_counter; k++) {
+                if (submission_only &&
+                    strcmp(func_list[k].description, SUBMIT_DESCRIPTION) != 0)
+                    continue;
+                jobs[njobs].funcid = k;
+                jobs[njobs].shape = shapes[i];
+                jobs[njobs].config = configs[j];
+                jobs[njobs].status = -1;
+                njobs++;
+            }
+
+    fflush(stdout);
+    while (next < njobs || running > 0) {
+        /* Keep every worker slot busy */
+        for (i = 0; i < workers && next < njobs; i++) {
+            int fd[2];
+            if (pids[i] != 0)
+                continue;
+            if (pipe(fd) < 0) {
+                next++;
+                continue;
+            }
+            pids[i] = fork();
+            if (pids[i] == 0) {
+                close(fd[0]);
+                run_job(&jobs[next], fd[1]);
+            }
+            close(fd[1]);
+            if (pids[i] < 0) {
+                pids[i] = 0;
+                close(fd[0]);
+                next++;
+                continue;
+            }
+            fds[i] = fd[0];
+            slot_job[i] = next++;
+            running++;
+        }
+        if (running == 0)
+            continue;
+
+        /* Collect whichever job finishes first */
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (i = 0; i < workers; i++) {
+            if (pids[i] != pid)
+                continue;
+            struct job *job = &jobs[slot_job[i]];
+            struct job done;
+            if (read(fds[i], &done, sizeof(done)) == sizeof(done))
+                *job = done;
+            close(fds[i]);
+            pids[i] = 0;
+            running--;
+        }
+    }
+
+    printf("%-6s %-6s %-10s %-5s %-32s %8s %10s %10s %10s %12s\n", "M", "N",
+           "s:E:b", "func", "description", "correct", "hits", "misses",
+           "evictions", "clock_cycles");
+    for (i = 0; i < njobs; i++) {
+        const struct job *job = &jobs[i];
+        char config[32];
+        sprintf(config, "%u:%u:%u", job->config.s, job->config.E, job->config.b);
+        printf("%-6zu %-6zu %-10s %-5d %-32.32s %8d", job->shape.M, job->shape.N,
+               config, job->funcid, func_list[job->funcid].description,
+               job->status == 0);
+        if (job->status == 0)
+            printf(" %10ld %10ld %10ld %12ld\n", job->hits, job->misses,
+                   job->evictions, get_clock_cycles(job->hits, job->misses));
+        else if (job->status > 0)
+            printf("  validation failed\n");
+        else
+            printf("  could not be evaluated\n");
+    }
+
+    free(jobs);
+    free(pids);
+    free(fds);
+    free(slot_job);
+}
+
+/*
+ * parse_shapes - Parse "MxN,MxN,..." into shapes, returns the count or
+ *     0 if spec is malformed
+ */
+static int parse_shapes(const char *spec, struct shape *shapes) {
+    int count = 0;
+    char *end;
+
+    for (;;) {
+        if (count == MAX_SHAPES)
+            return 0;
+        shapes[count].M = strtoul(spec, &end, 10);
+        if (end == spec || *end != 'x')
+            return 0;
+        spec = end + 1;
+        shapes[count].N = strtoul(spec, &end, 10);
+        if (end == spec || shapes[count].M == 0 || shapes[count].N == 0 ||
+            shapes[count].M > MAXN || shapes[count].N > MAXN)
+            return 0;
+        count++;
+        if (*end == '\0')
+            return count;
+        if (*end != ',')
+            return 0;
+        spec = end + 1;
+    }
+}
+
+/*
+ * parse_configs - Parse "s:E:b,s:E:b,..." into configs, returns the
+ *     count or 0 if spec is malformed
+ */
+static int parse_configs(const char *spec, struct cache_config *configs) {
+    int count = 0;
+    int used;
+
+    for (;;) {
+        if (count == MAX_CONFIGS)
+            return 0;
+        if (sscanf(spec, "%u:%u:%u%n", &configs[count].s, &configs[count].E,
+                   &configs[count].b, &used) != 3)
+            return 0;
+        count++;
+        spec += used;
+        if (*spec == '\0')
+            return count;
+        if (*spec != ',')
+            return 0;
+        spec++;
+    }
+}
+
 /*
  * usage - Print usage info
  */
 static void usage(char *argv[]) {
     printf("Usage: %s [-h] [-s] -M <rows> -N <cols>\n", argv[0]);
+    printf("       %s [-s] -j <jobs> [-S <MxN,...>] [-C <s:E:b,...>]\n", argv[0]);
     printf("Options:\n");
     printf("  -h          Print this help message.\n");
     printf("  -s          Check official submission only.\n");
     printf("  -M <rows>   Number of destination matrix rows (max %d)\n", MAXN);
     printf("  -N <cols>   Number of destination matrix columns (max %d)\n", MAXN);
+    printf("  -j <jobs>   Evaluate every function x shape x cache config with up to\n");
+    printf("              <jobs> processes and print one merged report\n");
+    printf("  -S <shapes> Shapes for -j, e.g. 32x32,63x65 (default -M x -N)\n");
+    printf("  -C <caches> Cache configs for -j, e.g. 5:1:6,6:2:6 (default %d:%d:%d)\n",
+           TEST_LOG_SET, TEST_ASSOC, TEST_LOG_BLOCK);
     printf("Example: %s -M 8 -N 8\n", argv[0]);
+    printf("Example: %s -j 8 -S 32x32,64x64,63x65 -C 5:1:6,5:2:6\n", argv[0]);
 }
 
 /*
@@ -180,10 +442,27 @@ int main(int argc, char *argv[]) {
     char c;
 
     bool submission_only = false;
+    int workers = 0;
+    char *shape_spec = NULL, *config_spec = NULL;
+    struct shape shapes[MAX_SHAPES];
+    struct cache_config configs[MAX_CONFIGS] = {
+        { TEST_LOG_SET, TEST_ASSOC, TEST_LOG_BLOCK }
+    };
+    int nshapes = 1, nconfigs = 1, i;
+    unsigned long long timeout = TIMEOUT;
 
 
-    while ((c = getopt(argc,argv,"hcsM:N:")) != -1) {
+    while ((c = getopt(argc,argv,"hcsM:N:j:S:C:")) != -1) {
         switch(c) {
+        case 'j':
+            workers = atoi(optarg);
+            break;
+        case 'S':
+            shape_spec = optarg;
+            break;
+        case 'C':
+            config_spec = optarg;
+            break;
         case 'M':
             M = (size_t) atoi(optarg);
             break;
@@ -202,12 +481,38 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (M == 0 || N == 0) {
+    if (workers > 0 && shape_spec) {
+        nshapes = parse_shapes(shape_spec, shapes);
+        if (nshapes == 0) {
+            printf("Error: Malformed shape list %s\n", shape_spec);
+            usage(argv);
+            exit(1);
+        }
+    } else {
+        shapes[0].M = M;
+        shapes[0].N = N;
+    }
+    if (workers > 0 && config_spec) {
+        nconfigs = parse_configs(config_spec, configs);
+        if (nconfigs == 0) {
+            printf("Error: Malformed cache config list %s\n", config_spec);
+            usage(argv);
+            exit(1);
+        }
+    }
+
+    if (workers == 0 && (M == 0 || N == 0)) {
         printf("Error: Missing required argument\n");
         usage(argv);
         exit(1);
     }
 
+    if (workers > 0 && !shape_spec && (M == 0 || N == 0)) {
+        printf("Error: -j needs -S or -M and -N\n");
+        usage(argv);
+        exit(1);
+    }
+
     if (M > MAXN || N > MAXN) {
         printf("Error: M or N exceeds %d\n", MAXN);
         usage(argv);
@@ -225,8 +530,17 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
-    /* Time out and give up after a while */
-    alarm(360);
+    /* Time out and give up after a while, longer for large matrices */
+    for (i = 0; i < nshapes; i++)
+        timeout += (unsigned long long) shapes[i].M * shapes[i].N * nconfigs *
+                   TIMEOUT_PER_MELEMENT / 1000000;
+    alarm(timeout < UINT_MAX ? (unsigned int) timeout : UINT_MAX);
+
+    if (workers > 0) {
+        eval_parallel(shapes, nshapes, configs, nconfigs, workers,
+                      submission_only);
+        return 0;
+    }
 
     /* Check the performance of the student's transpose function */
     eval_perf(TEST_LOG_SET, TEST_ASSOC, TEST_LOG_BLOCK,
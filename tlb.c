@@ -0,0 +1,335 @@
+/*
+ * tlb.c - Multi-level TLB and page mapping in front of the cache
+ *
+ * TLB entries carry the frame as well as the page, so a hit translates
+ * without touching the page table; only walks consult it. The page
+ * table is an open-addressed hash from page to frame that grows like
+ * the classifier's. Random frames come from a bijective mix of a
+ * counter, so no two pages ever share one.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "tlb.h"
+
+/* Virtual (and physical) address bits, and index bits per page table level */
+#define VA_BITS 48
+#define PT_BITS 9
+/* Smallest and largest page accepted: 4KB and 1GB */
+#define MIN_PAGE_BITS 12
+#define MAX_PAGE_BITS 30
+#define INITIAL_PAGES 1024
+
+typedef struct TlbEntry {
+	unsigned long long page;    /* page number + 1, 0 marks an empty entry */
+	unsigned long long frame;
+	unsigned long long lastUse;
+} TlbEntry;
+
+typedef struct TlbLevel {
+	TlbEntry *entries;      /* sets * ways, set-major */
+	int sets;
+	int ways;
+	int latency;
+	TlbLevelStats stats;
+} TlbLevel;
+
+typedef struct PageEntry {
+	unsigned long long page;    /* page number + 1, 0 marks an empty bucket */
+	unsigned long long frame;
+} PageEntry;
+
+struct Tlb {
+	TlbLevel levels[TLB_MAX_LEVELS];
+	int count;
+	int pageBits;
+	TlbMapping mapping;
+	int colorBits;          /* low page bits the color mapping keeps */
+	int frameBits;
+	int walkLevels;
+	int walkCycles;
+	unsigned long long seed;
+	unsigned long long clock;
+	unsigned long long translations;
+	unsigned long long walks;
+	unsigned long long cycles;      /* latency of every translation */
+	PageEntry *pages;
+	size_t pageCount;
+	size_t pageCap;
+};
+
+int tlbLevelParse(const char *spec, TlbLevelConfig *config) {
+	int *fields[3] = {&config->entries, &config->ways, &config->latency};
+	int i;
+	for (i = 0; i < 3; i++) {
+		char *end;
+		long value = strtol(spec, &end, 10);
+		if (end == spec || value < 0 || *end != (i < 2 ? ':' : '\0')) {
+			return 0;
+		}
+		*fields[i] = (int) value;
+		spec = end + 1;
+	}
+	return config->entries > 0 && config->ways > 0 && config->entries % config->ways == 0;
+}
+
+int tlbMappingParse(const char *name, TlbMapping *mapping) {
+	if (strcmp(name, "none") == 0) {
+		*mapping = TLB_MAP_NONE;
+	} else if (strcmp(name, "random") == 0) {
+		*mapping = TLB_MAP_RANDOM;
+	} else if (strcmp(name, "color") == 0) {
+		*mapping = TLB_MAP_COLOR;
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+int tlbPageParse(const char *spec, int *bits) {
+	char *end;
+	unsigned long long size = strtoull(spec, &end, 10);
+	int shift = 0;
+
+	if (end == spec) {
+		return 0;
+	}
+	switch (*end) {
+		case 'K': case 'k':
+		shift = 10;
+		end++;
+		break;
+		case 'M': case 'm':
+		shift = 20;
+		end++;
+		break;
+		case 'G': case 'g':
+		shift = 30;
+		end++;
+		break;
+	}
+	if (*end != '\0' || size == 0 || (size & (size - 1)) != 0) {
+		return 0;
+	}
+	*bits = __builtin_ctzll(size) + shift;
+	return *bits >= MIN_PAGE_BITS && *bits <= MAX_PAGE_BITS;
+}
+
+Tlb *tlbCreate(const TlbConfig *config, int indexBits) {
+	int i;
+
+	if (config->levelCount < 1 || config->levelCount > TLB_MAX_LEVELS ||
+		config->pageBits < MIN_PAGE_BITS || config->pageBits > MAX_PAGE_BITS) {
+		return NULL;
+	}
+	Tlb *tlb = (Tlb *) calloc(1, sizeof(Tlb));
+	if (!tlb) {
+		return NULL;
+	}
+	tlb->pageBits = config->pageBits;
+	tlb->mapping = config->mapping;
+	tlb->frameBits = VA_BITS - config->pageBits;
+	tlb->colorBits = indexBits > config->pageBits ? indexBits - config->pageBits : 0;
+	if (tlb->colorBits > tlb->frameBits) {
+		tlb->colorBits = tlb->frameBits;
+	}
+	tlb->walkLevels = (VA_BITS - config->pageBits + PT_BITS - 1) / PT_BITS;
+	tlb->walkCycles = config->walkCycles;
+	tlb->seed = config->seed;
+	tlb->pageCap = 2 * INITIAL_PAGES;
+	tlb->pages = (PageEntry *) calloc(tlb->pageCap, sizeof(PageEntry));
+	if (!tlb->pages) {
+		tlbFree(tlb);
+		return NULL;
+	}
+	for (i = 0; i < config->levelCount; i++) {
+		const TlbLevelConfig *levelConfig = &config->levels[i];
+		TlbLevel *level = &tlb->levels[tlb->count];
+		if (levelConfig->entries <= 0 || levelConfig->ways <= 0 ||
+			levelConfig->entries % levelConfig->ways != 0) {
+			tlbFree(tlb);
+			return NULL;
+		}
+		level->sets = levelConfig->entries / levelConfig->ways;
+		level->ways = levelConfig->ways;
+		level->latency = levelConfig->latency;
+		level->entries = (TlbEntry *) calloc(levelConfig->entries, sizeof(TlbEntry));
+		if (!level->entries) {
+			tlbFree(tlb);
+			return NULL;
+		}
+		tlb->count++;
+	}
+	return tlb;
+}
+
+/* A bijection of the low bits bits of x, scrambling them */
+static unsigned long long mix(unsigned long long x, int bits) {
+	unsigned long long mask = bits < 64 ? (1ULL << bits) - 1 : ~0ULL;
+	int shift = bits > 1 ? bits / 2 : 1;
+	x &= mask;
+	x ^= x >> shift;
+	x = (x * 0xff51afd7ed558ccdULL) & mask;
+	x ^= x >> shift;
+	x = (x * 0xc4ceb9fe1a85ec53ULL) & mask;
+	x ^= x >> shift;
+	return x;
+}
+
+/* Frame for the count-th page mapped, which is page */
+static unsigned long long newFrame(const Tlb *tlb, unsigned long long page, size_t count) {
+	unsigned long long colorMask = (1ULL << tlb->colorBits) - 1;
+
+	switch (tlb->mapping) {
+		case TLB_MAP_NONE:
+		break;
+		case TLB_MAP_RANDOM:
+		return mix(count ^ tlb->seed, tlb->frameBits);
+		case TLB_MAP_COLOR:
+		return (mix(count ^ tlb->seed, tlb->frameBits - tlb->colorBits) << tlb->colorBits) |
+			(page & colorMask);
+	}
+	return page;
+}
+
+static size_t hashPage(unsigned long long page, size_t cap) {
+	page *= 0x9e3779b97f4a7c15ULL;
+	return (size_t) (page >> 32) & (cap - 1);
+}
+
+/* Bucket holding page, or the empty bucket it would go in */
+static PageEntry *findPage(const Tlb *tlb, unsigned long long page) {
+	size_t h = hashPage(page, tlb->pageCap);
+	while (tlb->pages[h].page && tlb->pages[h].page != page + 1) {
+		h = (h + 1) & (tlb->pageCap - 1);
+	}
+	return &tlb->pages[h];
+}
+
+/* grow - Double the page table once it is half full */
+static int grow(Tlb *tlb) {
+	PageEntry *old = tlb->pages;
+	size_t oldCap = tlb->pageCap;
+	size_t i;
+
+	if (2 * (tlb->pageCount + 1) <= tlb->pageCap) {
+		return 1;
+	}
+	tlb->pages = (PageEntry *) calloc(oldCap * 2, sizeof(PageEntry));
+	if (!tlb->pages) {
+		tlb->pages = old;
+		return 0;
+	}
+	tlb->pageCap = oldCap * 2;
+	for (i = 0; i < oldCap; i++) {
+		if (old[i].page) {
+			*findPage(tlb, old[i].page - 1) = old[i];
+		}
+	}
+	free(old);
+	return 1;
+}
+
+/* walk - Read page's frame from the page table, mapping it on first touch */
+static unsigned long long walk(Tlb *tlb, unsigned long long page) {
+	PageEntry *entry = findPage(tlb, page);
+
+	tlb->walks++;
+	tlb->cycles += (unsigned long long) tlb->walkLevels * tlb->walkCycles;
+	if (entry->page) {
+		return entry->frame;
+	}
+	unsigned long long frame = newFrame(tlb, page, tlb->pageCount);
+	if (!grow(tlb)) {
+		return frame;
+	}
+	// the table may have been rebuilt, so look the bucket up again
+	entry = findPage(tlb, page);
+	entry->page = page + 1;
+	entry->frame = frame;
+	tlb->pageCount++;
+	return frame;
+}
+
+/* Entry of level holding page, or NULL */
+static TlbEntry *lookup(TlbLevel *level, unsigned long long page) {
+	TlbEntry *set = level->entries + (size_t) (page % level->sets) * level->ways;
+	int way;
+	for (way = 0; way < level->ways; way++) {
+		if (set[way].page == page + 1) {
+			return &set[way];
+		}
+	}
+	return NULL;
+}
+
+/* fill - Install page in level, over an empty or the least recently used entry */
+static void fill(TlbLevel *level, unsigned long long page, unsigned long long frame,
+	unsigned long long now) {
+	TlbEntry *set = level->entries + (size_t) (page % level->sets) * level->ways;
+	TlbEntry *victim = &set[0];
+	int way;
+	for (way = 1; way < level->ways && victim->page; way++) {
+		if (!set[way].page || set[way].lastUse < victim->lastUse) {
+			victim = &set[way];
+		}
+	}
+	victim->page = page + 1;
+	victim->frame = frame;
+	victim->lastUse = now;
+}
+
+unsigned long long tlbTranslate(Tlb *tlb, unsigned long long addr) {
+	unsigned long long page = addr >> tlb->pageBits;
+	unsigned long long frame = 0;
+	int served;
+
+	tlb->clock++;
+	tlb->translations++;
+	for (served = 0; served < tlb->count; served++) {
+		TlbLevel *level = &tlb->levels[served];
+		TlbEntry *entry = lookup(level, page);
+		if (entry) {
+			entry->lastUse = tlb->clock;
+			frame = entry->frame;
+			level->stats.hits++;
+			tlb->cycles += level->latency;
+			break;
+		}
+		level->stats.misses++;
+	}
+	if (served == tlb->count) {
+		frame = walk(tlb, page);
+	}
+	while (served-- > 0) {
+		fill(&tlb->levels[served], page, frame, tlb->clock);
+	}
+	return (frame << tlb->pageBits) | (addr & ((1ULL << tlb->pageBits) - 1));
+}
+
+const TlbLevelStats *tlbStats(const Tlb *tlb, int level) {
+	return &tlb->levels[level].stats;
+}
+
+void tlbReport(const Tlb *tlb, FILE *out) {
+	int i;
+	for (i = 0; i < tlb->count; i++) {
+		const TlbLevelStats *stats = &tlb->levels[i].stats;
+		fprintf(out, "TLB%d hits:%llu misses:%llu\n", i + 1, stats->hits, stats->misses);
+	}
+	fprintf(out, "walks:%llu walk_cycles:%llu pages:%zu avg_translation_cycles:%.2f\n",
+		tlb->walks, tlb->walks * tlb->walkLevels * (unsigned long long) tlb->walkCycles,
+		tlb->pageCount, tlb->translations ? (double) tlb->cycles / tlb->translations : 0);
+}
+
+void tlbFree(Tlb *tlb) {
+	if (!tlb) {
+		return;
+	}
+	int i;
+	for (i = 0; i < tlb->count; i++) {
+		free(tlb->levels[i].entries);
+	}
+	free(tlb->pages);
+	free(tlb);
+}
@@ -0,0 +1,89 @@
+/*
+ * tlb.h - Multi-level TLB and page mapping in front of the cache
+ *
+ * Addresses in a trace are virtual. A translation looks the virtual
+ * page up in each TLB level in turn (L1 first); a miss in every level
+ * walks the page table and fills all of them. Levels are set
+ * associative with LRU replacement.
+ *
+ * The page table maps each page to a frame the first time it is
+ * touched:
+ *
+ *   none       frame = page, physical addresses equal virtual ones
+ *   random     frames drawn pseudo-randomly (and without repeats), so
+ *              pages land in arbitrary cache sets, as under an OS
+ *              handing out whatever frame is free
+ *   color      page coloring: random frames that keep the page's low
+ *              bits that the cache indexes with, so a page maps to the
+ *              same sets it would virtually
+ *
+ * A walk reads one page table entry per level of a 48-bit x86-64 style
+ * radix table (4 levels for 4KB pages, 3 for 2MB, 2 for 1GB), each
+ * costing walkCycles.
+ */
+#ifndef TLB_H
+#define TLB_H
+
+#include <stdio.h>
+
+/* Most TLB levels */
+#define TLB_MAX_LEVELS 3
+/* Names accepted by tlbMappingParse, for usage messages */
+#define TLB_MAPPING_NAMES "none, random, color"
+
+typedef enum TlbMapping {
+	TLB_MAP_NONE,
+	TLB_MAP_RANDOM,
+	TLB_MAP_COLOR
+} TlbMapping;
+
+typedef struct TlbLevelConfig {
+	int entries;
+	int ways;               /* entries / ways sets */
+	int latency;            /* cycles for a translation this level serves */
+} TlbLevelConfig;
+
+typedef struct TlbConfig {
+	int pageBits;           /* 12 for 4KB pages, 21 for 2MB, 30 for 1GB */
+	TlbLevelConfig levels[TLB_MAX_LEVELS];
+	int levelCount;
+	TlbMapping mapping;
+	int walkCycles;         /* per page table level read in a walk */
+	unsigned long long seed;    /* of the random and color mappings */
+} TlbConfig;
+
+typedef struct TlbLevelStats {
+	unsigned long long hits;
+	unsigned long long misses;
+} TlbLevelStats;
+
+typedef struct Tlb Tlb;
+
+/* Parse "entries:ways:latency" into config. Returns 0 if spec is malformed */
+int tlbLevelParse(const char *spec, TlbLevelConfig *config);
+
+/* Returns 0 for an unknown name */
+int tlbMappingParse(const char *name, TlbMapping *mapping);
+
+/* Parse a page size such as 4096, 4K, 2M or 1G into *bits. Returns 0 if not a power of two */
+int tlbPageParse(const char *spec, int *bits);
+
+/*
+ * tlbCreate - indexBits is how many low address bits the cache's set
+ *             index and block offset use, which the color mapping
+ *             keeps. Returns NULL for an invalid configuration or when
+ *             out of memory.
+ */
+Tlb *tlbCreate(const TlbConfig *config, int indexBits);
+
+/* Translate a virtual address, counting TLB hits, misses and walks */
+unsigned long long tlbTranslate(Tlb *tlb, unsigned long long addr);
+
+const TlbLevelStats *tlbStats(const Tlb *tlb, int level);
+
+/* Print one line per TLB level, then walks, cycles and pages mapped */
+void tlbReport(const Tlb *tlb, FILE *out);
+
+void tlbFree(Tlb *tlb);
+
+#endif /* TLB_H */
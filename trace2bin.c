@@ -0,0 +1,177 @@
+/*
+ * trace2bin.c - Convert a text memory trace into the compact binary
+ *     format csim reads directly (layout described in tracereader.h).
+ *
+ * Usage: trace2bin <input> <output>, with "-" for stdin or stdout.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "tracereader.h"
+
+/*
+ * A block's records are held back until it is full, so it is known
+ * whether any of them needs a core id before the first is encoded.
+ */
+typedef struct BlockWriter {
+	FILE *out;
+	unsigned char *payload;
+	TraceRecord *pending;
+	unsigned int records;
+	unsigned long long total;
+	unsigned long long written;
+} BlockWriter;
+
+static void putU32(unsigned char *p, unsigned int value) {
+	p[0] = value;
+	p[1] = value >> 8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+}
+
+static unsigned char *putVarint(unsigned char *p, unsigned long long value) {
+	while (value >= 0x80) {
+		*p++ = (unsigned char) (value | 0x80);
+		value >>= 7;
+	}
+	*p++ = (unsigned char) value;
+	return p;
+}
+
+static int opCode(char op) {
+	int code;
+	for (code = 0; code < 4; code++) {
+		if (traceOps[code] == op) {
+			return code;
+		}
+	}
+	return 0;
+}
+
+static unsigned char *putRecord(unsigned char *p, const TraceRecord *rec,
+	unsigned long long prevAddr, int cores) {
+	unsigned int size = rec->size;
+
+	if (size < TRACE_BIN_SIZE_ESCAPE) {
+		*p++ = (unsigned char) (opCode(rec->op) << 6 | size);
+	} else {
+		*p++ = (unsigned char) (opCode(rec->op) << 6 | TRACE_BIN_SIZE_ESCAPE);
+		p = putVarint(p, size);
+	}
+	long long delta = (long long) (rec->addr - prevAddr);
+	p = putVarint(p, ((unsigned long long) delta << 1) ^ (unsigned long long) (delta >> 63));
+	if (cores) {
+		p = putVarint(p, rec->core);
+	}
+	return p;
+}
+
+static void flushBlock(BlockWriter *writer) {
+	unsigned char header[TRACE_BIN_BLOCK_HEADER];
+	unsigned char *p = writer->payload;
+	unsigned long long prevAddr = 0;
+	unsigned int i;
+	int cores = 0;
+
+	if (writer->records == 0) {
+		return;
+	}
+	for (i = 0; i < writer->records && !cores; i++) {
+		cores = writer->pending[i].core != 0;
+	}
+	for (i = 0; i < writer->records; i++) {
+		p = putRecord(p, &writer->pending[i], prevAddr, cores);
+		prevAddr = writer->pending[i].addr;
+	}
+	size_t bytes = p - writer->payload;
+	putU32(header, writer->records | (cores ? TRACE_BIN_BLOCK_CORES : 0));
+	putU32(header + 4, (unsigned int) bytes);
+	fwrite(header, 1, sizeof(header), writer->out);
+	fwrite(writer->payload, 1, bytes, writer->out);
+	writer->written += sizeof(header) + bytes;
+	writer->records = 0;
+}
+
+static void addRecord(BlockWriter *writer, const TraceRecord *rec) {
+	writer->pending[writer->records] = *rec;
+	writer->total++;
+	if (++writer->records == TRACE_BIN_BLOCK_RECORDS) {
+		flushBlock(writer);
+	}
+}
+
+int main(int argc, char **argv) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <input trace> <output file>\n", argv[0]);
+		fprintf(stderr, "  Either name may be - for stdin / stdout\n");
+		return 1;
+	}
+
+	TraceReader *reader = traceOpen(argv[1]);
+	if (!reader) {
+		fprintf(stderr, "Unable to open %s\n", argv[1]);
+		return 1;
+	}
+	FILE *out = strcmp(argv[2], "-") == 0 ? stdout : fopen(argv[2], "wb");
+	if (!out) {
+		fprintf(stderr, "Unable to create %s\n", argv[2]);
+		return 1;
+	}
+	// a partial file is removed on failure, but never a device or pipe
+	struct stat st;
+	int partial = out != stdout && fstat(fileno(out), &st) == 0 && S_ISREG(st.st_mode);
+
+	BlockWriter writer = { out, NULL, NULL, 0, 0, 0 };
+	writer.payload = (unsigned char *) malloc(
+		(size_t) TRACE_BIN_BLOCK_RECORDS * TRACE_BIN_MAX_RECORD);
+	writer.pending = (TraceRecord *) malloc(
+		(size_t) TRACE_BIN_BLOCK_RECORDS * sizeof(TraceRecord));
+	TraceRecord *batch = (TraceRecord *) malloc(TRACE_BATCH * sizeof(TraceRecord));
+	if (!writer.payload || !writer.pending || !batch) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	unsigned char header[TRACE_BIN_HEADER] = { 0 };
+	memcpy(header, TRACE_BIN_MAGIC, 4);
+	header[4] = TRACE_BIN_VERSION;
+	fwrite(header, 1, sizeof(header), out);
+	writer.written = sizeof(header);
+
+	size_t count;
+	size_t i;
+	while ((count = traceRead(reader, batch, TRACE_BATCH)) > 0) {
+		for (i = 0; i < count; i++) {
+			addRecord(&writer, &batch[i]);
+		}
+	}
+	flushBlock(&writer);
+
+	// fill in the record count when the output is seekable
+	if (fseek(out, 8, SEEK_SET) == 0) {
+		putU32(header + 8, (unsigned int) writer.total);
+		putU32(header + 12, (unsigned int) (writer.total >> 32));
+		fwrite(header + 8, 1, 8, out);
+	}
+
+	// fwrite errors stick to the stream; closing flushes what is buffered
+	int failed = ferror(out) != 0;
+	failed |= (out == stdout ? fflush(out) : fclose(out)) != 0;
+	if (failed) {
+		fprintf(stderr, "Unable to write %s\n", argv[2]);
+		if (partial) {
+			remove(argv[2]);
+		}
+	} else if (out != stdout) {
+		fprintf(stderr, "%llu records, %llu bytes\n", writer.total, writer.written);
+	}
+	traceClose(reader);
+	free(batch);
+	free(writer.payload);
+	free(writer.pending);
+	return failed;
+}
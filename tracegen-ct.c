@@ -16,6 +16,7 @@
 #include "cachelab.h"
 #include <string.h>
 #include <stdbool.h>
+#include <time.h>
 
 /* External variables declared in cachelab.c */
 extern trans_func_t func_list[MAX_TRANS_FUNCS];
@@ -30,42 +31,49 @@ extern void registerFunctions();
 extern void __roi_begin();
 extern void __roi_end();
 
-/* Need to make sure A and B start on cache block boundaries */
-static double bigA[MAXN][MAXN] __attribute__((aligned(64)));
-static double bigB[MAXN][MAXN] __attribute__((aligned(64)));
-static double bigT[TMPCOUNT]  __attribute__((aligned(64)));
-static double bigAcopy[MAXN][MAXN];
-static double bigBtarg[MAXN][MAXN];
+/* Rows and columns checked together by validate, keeping B's lines in cache */
+#define VALIDATE_BLOCK 64
+
+/* Laid out by allocMatrices, as tune-trans lays them out */
+static double *bigMatrices;
+static double *bigA;
+static double *bigB;
+static double *bigT;
 static size_t M;
 static size_t N;
+static unsigned long long seed;
 
 
-bool validate(int fn, double A[N][M], double Acopy[N][M], double B[M][N], double Btarg[M][N]) {
-    size_t i, j;
-    size_t xM = M+10;
-    if (xM > MAXN)
-        xM = MAXN;
-    for(i=0;i<M;i++) {
-        for(j=0;j<N;j++) {
-            if(B[i][j]!=Btarg[i][j]) {
-                fprintf(stderr, "Validation failed on function %d! Expected %.3f but got %.3f at B[%zd][%zd]\n",
-                       fn,Btarg[i][j],B[i][j],i,j);
-                return false;
+/*
+ * validate - Check B is the transpose of A, that A is untouched and
+ *     that nothing was written past B. A is checked against the values
+ *     initMatrix gave it rather than a copy, block by block so the
+ *     column walk over B stays in cache, so no extra matrix is needed.
+ */
+bool validate(int fn, double A[N][M], double B[M][N]) {
+    size_t i, j, ii, jj;
+
+    for (ii = 0; ii < N; ii += VALIDATE_BLOCK) {
+        for (jj = 0; jj < M; jj += VALIDATE_BLOCK) {
+            for (i = ii; i < N && i < ii + VALIDATE_BLOCK; i++) {
+                for (j = jj; j < M && j < jj + VALIDATE_BLOCK; j++) {
+                    double expected = matrixValue(seed, i, j);
+                    if (A[i][j] != expected) {
+                        fprintf(stderr, "Validation failed on function %d! A[%zd][%zd] corrupted\n", fn, i, j);
+                        return false;
+                    }
+                    if (B[j][i] != expected) {
+                        fprintf(stderr, "Validation failed on function %d! Expected %.3f but got %.3f at B[%zd][%zd]\n",
+                               fn, expected, B[j][i], j, i);
+                        return false;
+                    }
+                }
             }
         }
     }
 
-    /* Look for changes to A */
-    for (i = 0; i < M; i++)
-        for (j = 0; j < N; j++) {
-            if (A[i][j] != Acopy[i][j]) {
-                fprintf(stderr, "Validation failed on function %d! A[%zd][%zd] corrupted\n", fn, i, j);
-                return false;
-            }
-        }
-
     /* Look for out of bounds writes to B, scanning a few more rows */
-    for (i = M; i < xM; i++)
+    for (i = M; i < M + GUARD_ROWS; i++)
         for (j = 0; j < N; j++) {
             if (B[i][j] != 0) {
                 fprintf(stderr, "Validation failed on function %d! Out-of-bounds write to B[%zd][%zd]\n", fn, i, j);
@@ -76,7 +84,9 @@ bool validate(int fn, double A[N][M], double Acopy[N][M], double B[M][N], double
 }
 
 static void usage(char *cmd) {
-    fprintf(stderr, "Usage: %s [-h] [-M M] [-N N] [-F ID]\n", cmd);
+    fprintf(stderr, "Usage: %s [-hvH] [-M M] [-N N] [-F ID]\n", cmd);
+    fprintf(stderr, "  -v      Print csim -R options naming A, B and tmp\n");
+    fprintf(stderr, "  -H      Back A and B with transparent huge pages\n");
     fprintf(stderr, "  -N N    Set number of rows of A / cols of B\n");
     fprintf(stderr, "  -M M    Set number of cols of A / rows of B\n");
     fprintf(stderr, "  -F ID   Run function number ID\n");
@@ -88,7 +98,9 @@ int entry(int argc, char* argv[]){
 
     char c;
     int selectedFunc=-1;
-    while( (c=getopt(argc,argv,"hvM:N:F:")) != -1){
+    bool verbose = false;
+    bool hugePages = false;
+    while( (c=getopt(argc,argv,"hvHM:N:F:")) != -1){
         switch(c){
         case 'M':
             M = (size_t) atoi(optarg);
@@ -100,6 +112,10 @@ int entry(int argc, char* argv[]){
             selectedFunc = atoi(optarg);
             break;
         case 'v':
+            verbose = true;
+            break;
+        case 'H':
+            hugePages = true;
             break;
         case 'h':
         default:
@@ -109,40 +125,46 @@ int entry(int argc, char* argv[]){
     assert((M > 0) && (M <= MAXN));
     assert((N > 0) && (N <= MAXN));
 
-    /*  Register transpose functions */
-    registerFunctions();
+    bigMatrices = allocMatrices(M, N, hugePages, &bigA, &bigB, &bigT);
+    if (!bigMatrices) {
+        fprintf(stderr, "Unable to allocate %zd x %zd matrices\n", M, N);
+        return 1;
+    }
 
-    /* Clear out matrices */
-    memset(bigA, 0, sizeof(bigA));
-    memset(bigB, 0, sizeof(bigB));
+    /* Address ranges of the arrays, for csim -H heatmaps */
+    if (verbose) {
+        fprintf(stderr, "-R A:%p-%p -R B:%p-%p -R tmp:%p-%p\n",
+                (void *) bigA, (void *) ((char *) bigA + M * N * sizeof(double)),
+                (void *) bigB, (void *) ((char *) bigB + M * N * sizeof(double)),
+                (void *) bigT, (void *) (bigT + TMPCOUNT));
+    }
 
-    /* Fill A with data */
-    initMatrix(M,N, bigA, bigB);
-    /* Make copy of A */
-    memset(bigAcopy, 0, sizeof(bigAcopy));
-    copyMatrix(M,N, bigAcopy, bigA);
-    /* Generate target version */
-    memset(bigBtarg, 0, sizeof(bigBtarg));
-    correctTrans(M,N, bigA, bigBtarg);
+    /*  Register transpose functions */
+    registerFunctions();
 
+    /* Fill A with data and B with other data, leaving its guard rows zero */
+    seed = (unsigned long long) time(NULL);
+    initMatrix(M,N, (double (*)[M]) bigA, (double (*)[N]) bigB, seed);
 
     if (-1==selectedFunc) {
         /* Invoke registered transpose functions */
         for (i=0; i < func_counter; i++) {
-            memset(bigT, 0, sizeof(bigT));
+            memset(bigT, 0, TMPCOUNT * sizeof(double));
             __roi_begin();
-            (*func_list[i].func_ptr)(M, N, bigA, bigB, bigT);
+            (*func_list[i].func_ptr)(M, N, (const double (*)[M]) bigA,
+                                     (double (*)[N]) bigB, bigT);
             __roi_end();
-            if (!validate(i,bigA,bigAcopy,bigB,bigBtarg)) {
+            if (!validate(i, (double (*)[M]) bigA, (double (*)[N]) bigB)) {
                 return i+1;
             }
         }
     } else {
-        memset(bigT, 0, sizeof(bigT));
+        memset(bigT, 0, TMPCOUNT * sizeof(double));
         __roi_begin();
-        (*func_list[selectedFunc].func_ptr)(M, N, bigA, bigB, bigT);
+        (*func_list[selectedFunc].func_ptr)(M, N, (const double (*)[M]) bigA,
+                                            (double (*)[N]) bigB, bigT);
         __roi_end();
-        if (!validate(selectedFunc,bigA,bigAcopy,bigB,bigBtarg)) {
+        if (!validate(selectedFunc, (double (*)[M]) bigA, (double (*)[N]) bigB)) {
             return 1;
         }
 
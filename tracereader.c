@@ -0,0 +1,389 @@
+/*
+ * tracereader.c - Streaming reader for valgrind-style memory traces
+ *
+ * Each line has the form " L 7ff000398,8": an operation letter, a hex
+ * address and a decimal size, optionally followed by a core id.
+ * Parsing is done by hand instead of with fscanf, which is locale
+ * aware and takes the stream lock per call.
+ * Lines whose operation is not one of L, S, M or I (e.g. the "==pid=="
+ * banner valgrind prints) are skipped.
+ *
+ * Binary traces (see tracereader.h) are detected from their first
+ * bytes and decoded a block at a time.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tracereader.h"
+
+/* Size of a read() when the trace cannot be mapped */
+#define READ_BLOCK (4 << 20)
+
+const char traceOps[4] = { 'L', 'S', 'M', 'I' };
+
+struct TraceReader {
+	int fd;
+	int ownsFd;
+	char *map;          /* whole file when memory-mapped */
+	size_t mapLen;
+	char *buf;          /* block buffer otherwise */
+	size_t bufCap;
+	const char *cur;    /* next unparsed byte */
+	const char *end;    /* one past the last valid byte */
+	int eof;
+	int binary;
+	const char *blockEnd;   /* binary: end of the current block */
+	unsigned int blockLeft; /* binary: records left in it */
+	int blockCores;         /* binary: its records carry core ids */
+	unsigned long long prevAddr;
+};
+
+/* Hex digit value plus one; zero marks a non-digit */
+static const unsigned char hexDigit[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+static TraceReader *openReader(int fd, int ownsFd);
+static size_t readText(TraceReader *reader, TraceRecord *recs, size_t max);
+static size_t readBinary(TraceReader *reader, TraceRecord *recs, size_t max);
+static size_t parseText(const char **pos, const char *end,
+	TraceRecord *recs, size_t max);
+static const char *lastLineEnd(const char *begin, const char *end);
+static int nextBlock(TraceReader *reader);
+static int fill(TraceReader *reader, size_t need);
+static unsigned int getU32(const unsigned char *p);
+
+TraceReader *traceOpen(const char *path) {
+	if (strcmp(path, "-") == 0) {
+		return openReader(STDIN_FILENO, 0);
+	}
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	TraceReader *reader = openReader(fd, 1);
+	if (!reader) {
+		close(fd);
+	}
+	return reader;
+}
+
+TraceReader *traceOpenFd(int fd) {
+	return openReader(fd, 0);
+}
+
+static TraceReader *openReader(int fd, int ownsFd) {
+	TraceReader *reader = (TraceReader *) calloc(1, sizeof(TraceReader));
+	if (!reader) {
+		return NULL;
+	}
+	reader->fd = fd;
+	reader->ownsFd = ownsFd;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+			reader->map = (char *) map;
+			reader->mapLen = st.st_size;
+			reader->cur = reader->map;
+			reader->end = reader->map + reader->mapLen;
+			reader->eof = 1;
+		}
+	}
+
+	if (!reader->map) {
+		// pipes, stdin and files mmap refuses: fall back to block reads
+		reader->bufCap = READ_BLOCK;
+		reader->buf = (char *) malloc(reader->bufCap);
+		if (!reader->buf) {
+			free(reader);
+			return NULL;
+		}
+		reader->cur = reader->buf;
+		reader->end = reader->buf;
+		fill(reader, TRACE_BIN_HEADER);
+	}
+
+	if ((size_t) (reader->end - reader->cur) >= TRACE_BIN_HEADER &&
+		memcmp(reader->cur, TRACE_BIN_MAGIC, 4) == 0) {
+		unsigned char version = (unsigned char) reader->cur[4];
+		if (version < 1 || version > TRACE_BIN_VERSION) {
+			// a newer layout would decode to garbage; the caller keeps the fd
+			reader->ownsFd = 0;
+			traceClose(reader);
+			return NULL;
+		}
+		reader->binary = 1;
+		reader->cur += TRACE_BIN_HEADER;
+	}
+	return reader;
+}
+
+size_t traceRead(TraceReader *reader, TraceRecord *recs, size_t max) {
+	if (reader->binary) {
+		return readBinary(reader, recs, max);
+	}
+	return readText(reader, recs, max);
+}
+
+void traceClose(TraceReader *reader) {
+	if (!reader) {
+		return;
+	}
+	if (reader->map) {
+		munmap(reader->map, reader->mapLen);
+	}
+	free(reader->buf);
+	if (reader->ownsFd) {
+		close(reader->fd);
+	}
+	free(reader);
+}
+
+static size_t readText(TraceReader *reader, TraceRecord *recs, size_t max) {
+	for (;;) {
+		// only parse whole lines unless the rest of the input is here
+		const char *limit = reader->eof ? reader->end
+			: lastLineEnd(reader->cur, reader->end);
+		size_t n = parseText(&reader->cur, limit, recs, max);
+		if (n > 0 || (reader->eof && reader->cur == reader->end)) {
+			return n;
+		}
+		// fill marks eof when it cannot make progress, so this ends
+		fill(reader, (reader->end - reader->cur) + 1);
+	}
+}
+
+/*
+ * parseText - Parse records from [*pos, end), which must end on a line
+ *             boundary (or at the end of the trace). Advances *pos past
+ *             every line consumed.
+ */
+static size_t parseText(const char **pos, const char *end,
+	TraceRecord *recs, size_t max) {
+	const char *p = *pos;
+	size_t n = 0;
+
+	while (n < max && p < end) {
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+			p++;
+		}
+		if (p == end) {
+			break;
+		}
+
+		char op = *p++;
+		while (p < end && *p == ' ') {
+			p++;
+		}
+
+		unsigned long long addr = 0;
+		unsigned int digit;
+		while (p < end && (digit = hexDigit[(unsigned char) *p]) != 0) {
+			addr = (addr << 4) | (digit - 1);
+			p++;
+		}
+
+		unsigned int size = 0;
+		if (p < end && *p == ',') {
+			p++;
+			while (p < end && (unsigned int) (*p - '0') < 10) {
+				size = size * 10 + (unsigned int) (*p - '0');
+				p++;
+			}
+		}
+
+		unsigned int core = 0;
+		while (p < end && (*p == ' ' || *p == '\t')) {
+			p++;
+		}
+		while (p < end && (unsigned int) (*p - '0') < 10) {
+			core = core * 10 + (unsigned int) (*p - '0');
+			p++;
+		}
+
+		while (p < end && *p != '\n') {
+			p++;
+		}
+
+		if (op == 'L' || op == 'S' || op == 'M' || op == 'I') {
+			recs[n].addr = addr;
+			recs[n].size = size;
+			recs[n].op = op;
+			recs[n].core = (unsigned short) core;
+			n++;
+		}
+	}
+	*pos = p;
+	return n;
+}
+
+/* One past the last newline in [begin, end), or begin if there is none */
+static const char *lastLineEnd(const char *begin, const char *end) {
+	const char *p = end;
+	while (p > begin && p[-1] != '\n') {
+		p--;
+	}
+	return p;
+}
+
+/* Decode a varint from [*pos, end); stops quietly at end on bad input */
+static inline unsigned long long getVarint(const unsigned char **pos,
+	const unsigned char *end) {
+	const unsigned char *p = *pos;
+	unsigned long long value = 0;
+	int shift = 0;
+	while (p < end) {
+		unsigned char byte = *p++;
+		value |= (unsigned long long) (byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			break;
+		}
+		shift += 7;
+	}
+	*pos = p;
+	return value;
+}
+
+static size_t readBinary(TraceReader *reader, TraceRecord *recs, size_t max) {
+	size_t n = 0;
+
+	while (n < max) {
+		if (reader->blockLeft == 0 && !nextBlock(reader)) {
+			break;
+		}
+		const unsigned char *p = (const unsigned char *) reader->cur;
+		const unsigned char *end = (const unsigned char *) reader->blockEnd;
+		unsigned long long addr = reader->prevAddr;
+		size_t take = max - n;
+		if (take > reader->blockLeft) {
+			take = reader->blockLeft;
+		}
+		size_t i;
+		for (i = 0; i < take && p < end; i++) {
+			unsigned int packed = *p++;
+			unsigned int size = packed & 63;
+			if (size == TRACE_BIN_SIZE_ESCAPE) {
+				size = (unsigned int) getVarint(&p, end);
+			}
+			unsigned long long zigzag = getVarint(&p, end);
+			addr += (zigzag >> 1) ^ -(zigzag & 1);
+			recs[n + i].addr = addr;
+			recs[n + i].size = size;
+			recs[n + i].op = traceOps[packed >> 6];
+			recs[n + i].core = reader->blockCores ? (unsigned short) getVarint(&p, end) : 0;
+		}
+		n += i;
+		reader->prevAddr = addr;
+		reader->blockLeft -= i;
+		reader->cur = (const char *) p;
+		if (i < take || reader->blockLeft == 0) {
+			// done with the block, or its payload ran out early
+			reader->blockLeft = 0;
+			reader->cur = reader->blockEnd;
+		}
+	}
+	return n;
+}
+
+/*
+ * nextBlock - Make the next binary block current, reading all of it
+ *             into the buffer first when the trace is not mapped.
+ */
+static int nextBlock(TraceReader *reader) {
+	for (;;) {
+		if ((size_t) (reader->end - reader->cur) < TRACE_BIN_BLOCK_HEADER) {
+			fill(reader, TRACE_BIN_BLOCK_HEADER);
+			if ((size_t) (reader->end - reader->cur) < TRACE_BIN_BLOCK_HEADER) {
+				return 0;
+			}
+		}
+		// decode the whole header now: fill may move or reallocate the buffer
+		const unsigned char *header = (const unsigned char *) reader->cur;
+		unsigned int records = getU32(header) & ~TRACE_BIN_BLOCK_CORES;
+		int cores = (getU32(header) & TRACE_BIN_BLOCK_CORES) != 0;
+		size_t bytes = getU32(header + 4);
+		size_t need = TRACE_BIN_BLOCK_HEADER + bytes;
+
+		if ((size_t) (reader->end - reader->cur) < need) {
+			fill(reader, need);
+			if ((size_t) (reader->end - reader->cur) < need) {
+				return 0; // truncated trace
+			}
+		}
+		reader->cur += TRACE_BIN_BLOCK_HEADER;
+		reader->blockEnd = reader->cur + bytes;
+		reader->blockLeft = records;
+		reader->blockCores = cores;
+		reader->prevAddr = 0;
+		if (records > 0) {
+			return 1;
+		}
+		reader->cur = reader->blockEnd;
+	}
+}
+
+/*
+ * fill - Read until at least need unparsed bytes are buffered or the
+ *        input ends, moving the unparsed tail to the front of the
+ *        buffer first. Returns 0, with eof set, if nothing more could
+ *        be read.
+ */
+static int fill(TraceReader *reader, size_t need) {
+	if (reader->eof) {
+		return 0;
+	}
+	size_t pending = reader->end - reader->cur;
+	if (need > reader->bufCap) {
+		size_t cap = reader->bufCap;
+		while (cap < need) {
+			cap *= 2;
+		}
+		char *bigger = (char *) malloc(cap);
+		if (!bigger) {
+			reader->eof = 1;
+			return 0;
+		}
+		memcpy(bigger, reader->cur, pending);
+		free(reader->buf);
+		reader->buf = bigger;
+		reader->bufCap = cap;
+	} else {
+		memmove(reader->buf, reader->cur, pending);
+	}
+	reader->cur = reader->buf;
+	reader->end = reader->buf + pending;
+
+	size_t start = pending;
+	while (pending < need) {
+		ssize_t got = read(reader->fd, reader->buf + pending,
+			reader->bufCap - pending);
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+		if (got <= 0) {
+			reader->eof = 1;
+			break;
+		}
+		pending += got;
+	}
+	reader->end = reader->buf + pending;
+	return pending > start;
+}
+
+static unsigned int getU32(const unsigned char *p) {
+	return (unsigned int) p[0] | (unsigned int) p[1] << 8 |
+		(unsigned int) p[2] << 16 | (unsigned int) p[3] << 24;
+}
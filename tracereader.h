@@ -0,0 +1,77 @@
+/*
+ * tracereader.h - Streaming reader for valgrind-style memory traces
+ *
+ * Traces are memory-mapped when they live in a regular file and read
+ * in large blocks otherwise (pipes, stdin), then hand-parsed into
+ * batches of TraceRecord for the simulator.
+ *
+ * Binary traces written by trace2bin are recognised by their magic
+ * number and decoded directly. Their layout, all integers little
+ * endian:
+ *
+ *   header   "CLBT", version byte, 3 reserved bytes, u64 record count
+ *            (0 when the writer could not seek back to fill it in)
+ *   blocks   u32 record count, u32 payload bytes, then the payload;
+ *            the top bit of the count (version 2) flags a block whose
+ *            records carry core ids
+ *   record   packed byte: op in the top 2 bits (L, S, M, I), size in
+ *            the low 6 bits, 63 meaning a varint size follows; then
+ *            the zigzag varint delta from the previous address, which
+ *            restarts at 0 in every block; then, in flagged blocks,
+ *            the varint core id
+ *
+ * Text lines may end in a decimal core id after the size, as in
+ * " S 600a40,8 3", for traces interleaving several threads. Records
+ * without one belong to core 0.
+ */
+#ifndef TRACEREADER_H
+#define TRACEREADER_H
+
+#include <stddef.h>
+
+/* Number of records the simulator asks for at a time */
+#define TRACE_BATCH 4096
+
+#define TRACE_BIN_MAGIC "CLBT"
+#define TRACE_BIN_VERSION 2
+#define TRACE_BIN_HEADER 16
+#define TRACE_BIN_BLOCK_HEADER 8
+/* Flag in a block's record count: its records carry core ids */
+#define TRACE_BIN_BLOCK_CORES 0x80000000u
+/* Records per block written by trace2bin */
+#define TRACE_BIN_BLOCK_RECORDS 65536
+/* Longest encoding of a single record */
+#define TRACE_BIN_MAX_RECORD 20
+#define TRACE_BIN_SIZE_ESCAPE 63
+
+/* Operation letters indexed by their 2-bit binary code */
+extern const char traceOps[4];
+
+typedef struct TraceRecord {
+	unsigned long long addr;
+	unsigned int size;
+	char op;
+	unsigned short core;    /* issuing core or thread, 0 unless the trace says */
+} TraceRecord;
+
+typedef struct TraceReader TraceReader;
+
+/*
+ * traceOpen - Open a trace by path; "-" reads from standard input.
+ *             Returns NULL if it cannot be opened or is a binary trace
+ *             of a version this reader does not know.
+ */
+TraceReader *traceOpen(const char *path);
+
+/* Wrap an already open descriptor, as traceOpen; the reader does not close it */
+TraceReader *traceOpenFd(int fd);
+
+/*
+ * traceRead - Fill recs with up to max records, returns the number
+ *             stored. Returns 0 once the trace is exhausted.
+ */
+size_t traceRead(TraceReader *reader, TraceRecord *recs, size_t max);
+
+void traceClose(TraceReader *reader);
+
+#endif /* TRACEREADER_H */
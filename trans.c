@@ -24,13 +24,72 @@
 #include "cachelab.h"
 #include "contracts.h"
 
-#define SQUARE_MATRIX_BLOCK 8
-#define RECT_MATRIX_BLOCK 4
-#define SQUARE_MATRIX_SIZE 32
-#define RECT_MATRIX_ROWS 63
-#define RECT_MATRIX_COLS 65
+/*
+ * Tiles the recursive transpose stops splitting at: rows of A filling
+ * one 64-byte block of a B row, by half a block of A columns so the
+ * B rows written stay in distinct sets even for power-of-two widths
+ */
+#define OBLIVIOUS_TILE_ROWS 8
+#define OBLIVIOUS_TILE_COLS 4
+
+/*
+ * Every element move of the blocked and recursive transposes goes
+ * through TRANS_COPY so tune-trans can include this file and watch
+ * the accesses
+ */
+#ifndef TRANS_COPY
+#define TRANS_COPY(dst, src) ((dst) = (src))
+#endif
+
+/* Order in which the blocked transpose visits its blocks */
+enum trans_order {
+    TRANS_ROW_MAJOR,        /* along the rows of A */
+    TRANS_COL_MAJOR         /* along the columns of A */
+};
+
+/* A variant of the blocked transpose */
+struct trans_params {
+    int block_rows;         /* rows of A per block */
+    int block_cols;         /* columns of A per block */
+    int order;              /* an enum trans_order */
+    int diagonal;           /* pass diagonal blocks of square matrices through tmp */
+    int unroll;             /* rows of A interleaved per column step */
+};
+
+/* The variant to use for one shape */
+struct trans_tuning {
+    size_t M;
+    size_t N;
+    struct trans_params params;
+};
+
+/*
+ * Fastest variants on the graded cache (s=5, E=1, b=6) found by
+ * tune-trans; regenerate with "./tune-trans" and paste its output. It
+ * lays A, B and tmp out with allocMatrices as tracegen-ct does, so any
+ * "-S" subset reproduces its rows.
+ * Shapes without an entry use the cache-oblivious transpose.
+ */
+static const struct trans_tuning tuning_table[] = {
+    /* tune-trans -s 5 -E 1 -b 6 */
+    { 1, 1, { 1, 1, TRANS_ROW_MAJOR, 0, 1 } }, /* misses 2, cycles 200 */
+    { 7, 2, { 1, 1, TRANS_ROW_MAJOR, 0, 1 } }, /* misses 17, cycles 1744 */
+    /* 3 x 15: cache-oblivious, misses 32, cycles 3432 */
+    /* 137 x 1: cache-oblivious, misses 274, cycles 27400 */
+    { 6, 60, { 1, 1, TRANS_ROW_MAJOR, 0, 1 } }, /* misses 124, cycles 14784 */
+    { 57, 57, { 1, 8, TRANS_COL_MAJOR, 0, 1 } }, /* misses 1586, cycles 178248 */
+    { 128, 128, { 2, 8, TRANS_COL_MAJOR, 1, 2 } }, /* misses 10398, cycles 1137472 */
+    { 32, 32, { 1, 8, TRANS_COL_MAJOR, 1, 1 } }, /* misses 317, cycles 40672 */
+    { 64, 64, { 4, 8, TRANS_COL_MAJOR, 1, 4 } }, /* misses 1640, cycles 194304 */
+    { 63, 65, { 16, 4, TRANS_ROW_MAJOR, 0, 1 } }, /* misses 2281, cycles 251736 */
+};
+
 /* Forward declarations */
-static int findMin(int a, int b);
+static size_t findMin(size_t a, size_t b);
+static void transpose_blocked(size_t M, size_t N, const double A[N][M], double B[M][N],
+                              double *tmp, const struct trans_params *params);
+static void transpose_oblivious(size_t M, size_t N, const double A[N][M], double B[M][N],
+                                double *tmp);
 
 /*
  * transpose_submit - This is the solution transpose function that you
@@ -44,63 +103,135 @@ static const char transpose_submit_desc[] = "Transpose submission";
 
 static void transpose_submit(size_t M, size_t N, const double A[N][M], double B[M][N], double *tmp)
 {
-    /*
-     * This is a good place to call your favorite transposition functions
-     * It's OK to choose different functions based on array size, but
-     * your code must be correct for all values of M and N
-     */
-
-    // Special optimization for 32 x 32 matrix 
-    if (M == SQUARE_MATRIX_SIZE
-        && N == SQUARE_MATRIX_SIZE){
-
-        int i, j, k, l;
-        for (i = 0; i < M; i += SQUARE_MATRIX_BLOCK) {
-            for (j = 0; j < N; j += SQUARE_MATRIX_BLOCK ) {
-                for (k = i ; k < i + SQUARE_MATRIX_BLOCK; k++) {
-                    for (l = j; l < j + SQUARE_MATRIX_BLOCK; l++) {
-                        if (i == j) {
-                        // diagonal, put a row of block into tmp
-                        *(tmp + SQUARE_MATRIX_BLOCK * (i + 1) + l) = A[k][l];
-                       } else {
-                        B[l][k] = A[k][l];
-                       }
+    size_t i;
+
+    // Use the tuned variant for this shape if there is one
+    for (i = 0; i < sizeof(tuning_table) / sizeof(tuning_table[0]); i++) {
+        if (tuning_table[i].M == M && tuning_table[i].N == N) {
+            transpose_blocked(M, N, A, B, tmp, &tuning_table[i].params);
+            return;
+        }
+    }
+    transpose_oblivious(M, N, A, B, tmp);
+}
+
+/*
+ * transpose_blocked - Transpose block by block as params describe. The
+ *     rows of a block are taken unroll at a time and interleaved, so B
+ *     is written unroll consecutive elements at a time. Diagonal
+ *     blocks of square matrices first copy those rows of A into tmp,
+ *     as A's row and the B row it lands on share a cache set there.
+ */
+static void transpose_blocked(size_t M, size_t N, const double A[N][M], double B[M][N],
+                              double *tmp, const struct trans_params *params)
+{
+    size_t bh = params->block_rows, bw = params->block_cols;
+    size_t blocks_across = (M + bw - 1) / bw, blocks_down = (N + bh - 1) / bh;
+    size_t n, row, col, rows, cols, k, l, u, step;
+    bool diagonal;
+
+    for (n = 0; n < blocks_across * blocks_down; n++) {
+        if (params->order == TRANS_ROW_MAJOR) {
+            row = n / blocks_across * bh;
+            col = n % blocks_across * bw;
+        } else {
+            row = n % blocks_down * bh;
+            col = n / blocks_down * bw;
+        }
+        rows = findMin(bh, N - row);
+        cols = findMin(bw, M - col);
+        diagonal = params->diagonal && M == N && row < col + cols && col < row + rows;
+
+        for (k = row; k < row + rows; k += step) {
+            step = findMin(params->unroll, row + rows - k);
+            if (diagonal) {
+                for (u = 0; u < step; u++) {
+                    for (l = col; l < col + cols; l++) {
+                        TRANS_COPY(tmp[u * bw + l - col], A[k + u][l]);
                     }
-                    if (i == j) {
-                        //now put into a column of block from tmp
-                        for (l = j; l < j + SQUARE_MATRIX_BLOCK; l++) {
-                            B[l][k] = *(tmp + SQUARE_MATRIX_BLOCK * (i + 1) + l);
-                        }
+                }
+                for (l = col; l < col + cols; l++) {
+                    for (u = 0; u < step; u++) {
+                        TRANS_COPY(B[l][k + u], tmp[u * bw + l - col]);
                     }
                 }
-            }
-        }
-    } 
-    else if (M == RECT_MATRIX_ROWS
-        && N == RECT_MATRIX_COLS) {
-        
-        // Special optimization for 63 x 65 matrix
-        int i, j, k, l;
-        for (i = 0; i < N; i += RECT_MATRIX_BLOCK) {
-            for (j = 0; j < M; j += RECT_MATRIX_BLOCK ) {
-                for (k = i ; k < findMin(N,i + RECT_MATRIX_BLOCK); k++) {
-                    for (l = j; l < findMin(M,j + RECT_MATRIX_BLOCK); l++) {
-                        B[l][k] = A[k][l];
+            } else {
+                for (l = col; l < col + cols; l++) {
+                    for (u = 0; u < step; u++) {
+                        TRANS_COPY(B[l][k + u], A[k + u][l]);
                     }
                 }
             }
         }
-    } else{
-         // Regular transpose 
-        int i, j;
-        for (i = 0; i < N; i++) {
-            for (j = 0; j < M; j++) {	        
-                B[j][i] = A[i][j];	       
-            }	        
+    }
+}
+
+/*
+ * transpose_tile - Transpose rows [row, row + rows) and columns
+ *     [col, col + cols) of A, one tile at most. When a square matrix's
+ *     tile straddles the diagonal, A's row and the B row it lands on
+ *     share a cache set, so each row of A goes through tmp first and
+ *     is fully read before B evicts it.
+ */
+static void transpose_tile(size_t M, size_t N, const double A[N][M], double B[M][N],
+                           double *tmp, size_t row, size_t rows, size_t col, size_t cols)
+{
+    size_t k, l;
+    bool diagonal = M == N && row < col + cols && col < row + rows;
+
+    for (k = row; k < row + rows; k++) {
+        if (diagonal) {
+            for (l = col; l < col + cols; l++) {
+                TRANS_COPY(tmp[l - col], A[k][l]);
+            }
+            for (l = col; l < col + cols; l++) {
+                TRANS_COPY(B[l][k], tmp[l - col]);
+            }
+        } else {
+            for (l = col; l < col + cols; l++) {
+                TRANS_COPY(B[l][k], A[k][l]);
+            }
         }
     }
 }
 
+/*
+ * transpose_recursive - Halve the longer side of the region, on a tile
+ *     boundary, until it is a single tile. Every level of the recursion
+ *     works on a region about twice the size of the one below, so some
+ *     level fits the cache whatever its size, without tuning for it.
+ */
+static void transpose_recursive(size_t M, size_t N, const double A[N][M], double B[M][N],
+                                double *tmp, size_t row, size_t rows, size_t col, size_t cols)
+{
+    size_t half;
+
+    if (rows <= OBLIVIOUS_TILE_ROWS && cols <= OBLIVIOUS_TILE_COLS) {
+        transpose_tile(M, N, A, B, tmp, row, rows, col, cols);
+        return;
+    }
+    // split the side that is longer in tiles
+    if (rows * OBLIVIOUS_TILE_COLS >= cols * OBLIVIOUS_TILE_ROWS) {
+        half = (rows / 2 + OBLIVIOUS_TILE_ROWS - 1) / OBLIVIOUS_TILE_ROWS * OBLIVIOUS_TILE_ROWS;
+        transpose_recursive(M, N, A, B, tmp, row, half, col, cols);
+        transpose_recursive(M, N, A, B, tmp, row + half, rows - half, col, cols);
+    } else {
+        half = (cols / 2 + OBLIVIOUS_TILE_COLS - 1) / OBLIVIOUS_TILE_COLS * OBLIVIOUS_TILE_COLS;
+        transpose_recursive(M, N, A, B, tmp, row, rows, col, half);
+        transpose_recursive(M, N, A, B, tmp, row, rows, col + half, cols - half);
+    }
+}
+
+/*
+ * transpose_oblivious - Cache-oblivious recursive transpose for any shape
+ */
+static const char transpose_oblivious_desc[] = "Cache-oblivious recursive transpose";
+
+static void transpose_oblivious(size_t M, size_t N, const double A[N][M], double B[M][N], double *tmp)
+{
+    transpose_recursive(M, N, A, B, tmp, 0, N, 0, M);
+}
+
 /*
  * registerFunctions - This function registers your transpose
  *     functions with the driver.  At runtime, the driver will
@@ -112,9 +243,12 @@ void registerFunctions(void)
 {
     /* Register your solution function */
     registerTransFunction(transpose_submit, transpose_submit_desc);
+
+    /* Register any additional transpose functions */
+    registerTransFunction(transpose_oblivious, transpose_oblivious_desc);
 }
 
-static int findMin(int a, int b) {
+static size_t findMin(size_t a, size_t b) {
     if (a < b) return a;
     return b;
 }
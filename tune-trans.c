@@ -0,0 +1,258 @@
+/*
+ * tune-trans.c - Searches the blocked transpose's parameters (block
+ *     height and width, block order, diagonal buffering through tmp,
+ *     row interleaving) for the variant that runs fastest on the
+ *     simulated cache, for every shape asked for, and prints the
+ *     tuning table that transpose_submit dispatches on.
+ *
+ * trans.c is compiled into this program with every element move routed
+ * through tune_copy, which feeds the addresses to an in-process
+ * simulator, so the variants measured are exactly the code in trans.c.
+ * Each shape gets its own allocMatrices block, the layout tracegen-ct
+ * and test-trans run under, so a shape's entry doesn't depend on which
+ * other shapes were tuned alongside it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <limits.h>
+#include "cachelab.h"
+#include "sim.h"
+
+static void tune_copy(double *dst, const double *src);
+#define TRANS_COPY(dst, src) tune_copy(&(dst), &(src))
+#include "trans.c"
+
+/* Cost model and default cache, as in test-trans */
+#define HIT_CYCLES 4
+#define MISS_CYCLES 100
+#define TEST_LOG_SET 5
+#define TEST_ASSOC 1
+#define TEST_LOG_BLOCK 6
+
+/* Most shapes that can be tuned in one run */
+#define MAX_SHAPES 32
+
+struct shape {
+    size_t M;
+    size_t N;
+};
+
+/* The shapes driver.py tests */
+static const struct shape driver_shapes[] = {
+    {1, 1}, {7, 2}, {3, 15}, {137, 1}, {6, 60},
+    {57, 57}, {128, 128}, {32, 32}, {64, 64}, {63, 65}
+};
+
+/* Candidate values of each parameter */
+static const int block_sizes[] = {1, 2, 4, 8, 16};
+static const int orders[] = {TRANS_ROW_MAJOR, TRANS_COL_MAJOR};
+static const int unrolls[] = {1, 2, 4};
+
+#define COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+/* Laid out per shape by allocMatrices, exactly as tracegen-ct lays them out */
+static double *bigA;
+static double *bigB;
+static double *bigT;
+
+static Sim *sim;
+static TraceRecord batch[TRACE_BATCH];
+static size_t batch_count;
+
+static void record(char op, const double *ptr) {
+    if (batch_count == TRACE_BATCH) {
+        simAccess(sim, batch, batch_count);
+        batch_count = 0;
+    }
+    batch[batch_count].addr = (unsigned long long) (uintptr_t) ptr;
+    batch[batch_count].size = sizeof(double);
+    batch[batch_count].op = op;
+    batch_count++;
+}
+
+static void tune_copy(double *dst, const double *src) {
+    record('L', src);
+    record('S', dst);
+    *dst = *src;
+}
+
+/*
+ * evaluate - Simulate one transpose of an M x N matrix, with params or
+ *     (when params is NULL) the cache-oblivious fallback. Returns the
+ *     cycles it costs, or -1 if the result is wrong.
+ */
+static long evaluate(size_t M, size_t N, const SimConfig *config,
+                     const struct trans_params *params, long *misses) {
+    double (*A)[M] = (double (*)[M]) bigA;
+    double (*B)[N] = (double (*)[N]) bigB;
+    SimStats stats;
+    size_t i, j;
+    bool correct = true;
+
+    for (i = 0; i < N; i++)
+        for (j = 0; j < M; j++)
+            A[i][j] = (double) (i * M + j);
+    memset(bigB, 0, M * N * sizeof(double));
+
+    sim = simCreate(config);
+    if (!sim) {
+        fprintf(stderr, "Unable to simulate s=%d E=%d b=%d\n",
+                config->s, config->E, config->b);
+        exit(1);
+    }
+    if (params)
+        transpose_blocked(M, N, (const double (*)[M]) A, B, bigT, params);
+    else
+        transpose_oblivious(M, N, (const double (*)[M]) A, B, bigT);
+    simAccess(sim, batch, batch_count);
+    batch_count = 0;
+    simStats(sim, &stats);
+    simDestroy(sim);
+
+    for (i = 0; i < N; i++)
+        for (j = 0; j < M; j++)
+            if (B[j][i] != A[i][j])
+                correct = false;
+    *misses = (long) stats.misses;
+    return correct ? (long) (HIT_CYCLES * stats.hits + MISS_CYCLES * stats.misses) : -1;
+}
+
+/*
+ * tune_shape - Try every variant on one shape and print its table line,
+ *     or a comment when the cache-oblivious fallback is as fast
+ */
+static void tune_shape(size_t M, size_t N, const SimConfig *config, bool verbose) {
+    struct trans_params params, best = {0, 0, 0, 0, 0};
+    long best_cycles = LONG_MAX, best_misses = 0, cycles, misses;
+    size_t h, w, o, d, u;
+    double *matrices = allocMatrices(M, N, false, &bigA, &bigB, &bigT);
+
+    if (!matrices) {
+        printf("Error: Unable to allocate %zu x %zu matrices\n", M, N);
+        exit(1);
+    }
+
+    for (h = 0; h < COUNT(block_sizes); h++)
+    for (w = 0; w < COUNT(block_sizes); w++)
+    for (o = 0; o < COUNT(orders); o++)
+    for (d = 0; d < (M == N ? 2 : 1); d++)
+    for (u = 0; u < COUNT(unrolls); u++) {
+        params.block_rows = block_sizes[h];
+        params.block_cols = block_sizes[w];
+        params.order = orders[o];
+        params.diagonal = (int) d;
+        params.unroll = unrolls[u];
+        if (params.unroll > params.block_rows)
+            continue;
+        cycles = evaluate(M, N, config, &params, &misses);
+        if (verbose)
+            fprintf(stderr, "%zux%zu rows:%d cols:%d order:%d diagonal:%d unroll:%d "
+                    "misses:%ld cycles:%ld\n", M, N, params.block_rows,
+                    params.block_cols, params.order, params.diagonal,
+                    params.unroll, misses, cycles);
+        if (cycles >= 0 && cycles < best_cycles) {
+            best = params;
+            best_cycles = cycles;
+            best_misses = misses;
+        }
+    }
+
+    cycles = evaluate(M, N, config, NULL, &misses);
+    free(matrices);
+    if (cycles >= 0 && cycles <= best_cycles) {
+        printf("    /* %zu x %zu: cache-oblivious, misses %ld, cycles %ld */\n",
+               M, N, misses, cycles);
+        return;
+    }
+    printf("    { %zu, %zu, { %d, %d, %s, %d, %d } }, /* misses %ld, cycles %ld */\n",
+           M, N, best.block_rows, best.block_cols,
+           best.order == TRANS_ROW_MAJOR ? "TRANS_ROW_MAJOR" : "TRANS_COL_MAJOR",
+           best.diagonal, best.unroll, best_misses, best_cycles);
+}
+
+/*
+ * parse_shapes - Parse "MxN,MxN,..." into shapes, returns the count or
+ *     0 if spec is malformed
+ */
+static int parse_shapes(const char *spec, struct shape *shapes) {
+    int count = 0;
+    char *end;
+
+    for (;;) {
+        if (count == MAX_SHAPES)
+            return 0;
+        shapes[count].M = strtoul(spec, &end, 10);
+        if (end == spec || *end != 'x')
+            return 0;
+        spec = end + 1;
+        shapes[count].N = strtoul(spec, &end, 10);
+        if (end == spec || shapes[count].M == 0 || shapes[count].N == 0 ||
+            shapes[count].M > MAXN || shapes[count].N > MAXN)
+            return 0;
+        count++;
+        if (*end == '\0')
+            return count;
+        if (*end != ',')
+            return 0;
+        spec = end + 1;
+    }
+}
+
+static void usage(char *argv[]) {
+    printf("Usage: %s [-hv] [-s <s>] [-E <E>] [-b <b>] [-S <MxN,...>]\n", argv[0]);
+    printf("Options:\n");
+    printf("  -h          Print this help message.\n");
+    printf("  -v          Print the cost of every variant tried (to stderr).\n");
+    printf("  -s <s>      Set index bits of the cache (default %d)\n", TEST_LOG_SET);
+    printf("  -E <E>      Lines per set (default %d)\n", TEST_ASSOC);
+    printf("  -b <b>      Block offset bits (default %d)\n", TEST_LOG_BLOCK);
+    printf("  -S <shapes> Shapes to tune, e.g. 32x32,63x65 (default driver.py's)\n");
+}
+
+int main(int argc, char *argv[]) {
+    SimConfig config = { .s = TEST_LOG_SET, .E = TEST_ASSOC, .b = TEST_LOG_BLOCK };
+    struct shape shapes[MAX_SHAPES];
+    int nshapes = COUNT(driver_shapes), i, c;
+    bool verbose = false;
+
+    memcpy(shapes, driver_shapes, sizeof(driver_shapes));
+    while ((c = getopt(argc, argv, "hvs:E:b:S:")) != -1) {
+        switch (c) {
+        case 'v':
+            verbose = true;
+            break;
+        case 's':
+            config.s = atoi(optarg);
+            break;
+        case 'E':
+            config.E = atoi(optarg);
+            break;
+        case 'b':
+            config.b = atoi(optarg);
+            break;
+        case 'S':
+            nshapes = parse_shapes(optarg, shapes);
+            if (nshapes == 0) {
+                printf("Error: Malformed shape list %s\n", optarg);
+                usage(argv);
+                exit(1);
+            }
+            break;
+        case 'h':
+            usage(argv);
+            exit(0);
+        default:
+            usage(argv);
+            exit(1);
+        }
+    }
+
+    printf("    /* tune-trans -s %d -E %d -b %d */\n", config.s, config.E, config.b);
+    for (i = 0; i < nshapes; i++)
+        tune_shape(shapes[i].M, shapes[i].N, &config, verbose);
+    return 0;
+}